@@ -1,6 +1,10 @@
 #include "asyncmanager.h"
 #include <QDebug>
 
+// lets a task queue its follow-ups on the deque of the worker running it
+static thread_local AsyncManager *t_manager = nullptr;
+static thread_local size_t t_worker = 0;
+
 AsyncManager *AsyncManager::m_instance = nullptr;
 AsyncManager *AsyncManager::Get()
 {
@@ -18,46 +22,135 @@ void AsyncManager::Destroy()
     }
 }
 
-void AsyncManager::WorkerThread()
+void AsyncManager::WorkerThread(size_t index)
 {
+    t_manager = this;
+    t_worker = index;
     for (;;)
     {
-        std::function<void(void)> myFunc;
+        Task task;
+        if (!PopTask(index, task))
         {
-            //LOG_INFO("%s | waiting for notification!", __FUNCTION__);
             std::unique_lock<std::mutex> lock(this->m_queue_mutex);
             m_condition.wait(lock, [this]
             {
-                return m_stop || !m_tasks.empty();
+                return HasRunnableTask() || (m_stop && !HasPendingTask());
             }
             );
 
-            if (m_stop && m_tasks.empty())
+            if (m_stop && !HasPendingTask())
             {
                 return;
             }
+            continue;
+        }
 
-            myFunc = std::move(m_tasks.front());
-            m_tasks.pop();
-            //LOG_INFO("%s | running task", __FUNCTION__);
+        bool cancelled = task.discarded || task.token.IsCancelled();
+        if (!cancelled && task.function)
+        {
+            task.function();
+        }
+        else if (cancelled && task.dropped)
+        {
+            task.dropped();
         }
 
-        if (myFunc)
         {
-            myFunc();
+            std::unique_lock<std::mutex> lock(m_queue_mutex);
+            m_running[task.priority]--;
+            if (cancelled)
+                m_metrics.cancelled[task.priority]++;
         }
-        else
+        // a long running slot got free
+        if (task.priority != TASK_INTERACTIVE)
+            m_condition.notify_one();
+    }
+}
+
+bool AsyncManager::PopTask(size_t index, Task& task)
+{
+    for (int lane = TASK_INTERACTIVE; lane < TASK_PRIORITY_COUNT; ++lane)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_queue_mutex);
+            if (m_pending[lane] == 0)
+                continue;
+            if (lane != TASK_INTERACTIVE && m_running[TASK_BULK] + m_running[TASK_BACKGROUND] >= m_maxLongRunning)
+                continue;
+            // reserve the slot before looking, two workers must not both pass the check
+            m_running[lane]++;
+        }
+
+        bool found = false;
         {
-            //LOG_ERROR( "%s | ERROR, empty function pointer for task", __FUNCTION__);
+            Worker& own = *m_queues[index];
+            std::unique_lock<std::mutex> lock(own.mutex);
+            if (!own.lanes[lane].empty())
+            {
+                task = std::move(own.lanes[lane].back());
+                own.lanes[lane].pop_back();
+                found = true;
+            }
         }
+        for (size_t i = 1; !found && i < m_queues.size(); ++i)
+        {
+            Worker& victim = *m_queues[(index + i) % m_queues.size()];
+            std::unique_lock<std::mutex> lock(victim.mutex);
+            if (!victim.lanes[lane].empty())
+            {
+                task = std::move(victim.lanes[lane].front());
+                victim.lanes[lane].pop_front();
+                found = true;
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(m_queue_mutex);
+        if (!found)
+        {
+            m_running[lane]--;
+            continue;
+        }
+        m_pending[lane]--;
+        task.discarded = m_stop;
+        double waited = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - task.queued).count();
+        m_metrics.started[lane]++;
+        m_totalWaitMs[lane] += waited;
+        if (waited > m_metrics.maxWaitMs[lane])
+            m_metrics.maxWaitMs[lane] = waited;
+        return true;
     }
+    return false;
+}
+
+bool AsyncManager::HasRunnableTask()
+{
+    if (m_pending[TASK_INTERACTIVE])
+        return true;
+    return (m_pending[TASK_BULK] || m_pending[TASK_BACKGROUND]) && m_running[TASK_BULK] + m_running[TASK_BACKGROUND] < m_maxLongRunning;
+}
+
+bool AsyncManager::HasPendingTask()
+{
+    for (int lane = TASK_INTERACTIVE; lane < TASK_PRIORITY_COUNT; ++lane)
+    {
+        if (m_pending[lane])
+            return true;
+    }
+    return false;
 }
 
 AsyncManager::AsyncManager()
+    : m_nextQueue(0)
+    , m_stop(false)
+    , m_pending()
+    , m_running()
+    , m_maxLongRunning(1)
+    , m_totalWaitMs()
 {
 }
 
 AsyncManager::AsyncManager(size_t numberOfThreads)
+    : AsyncManager()
 {
     Init(numberOfThreads);
 }
@@ -69,19 +162,51 @@ AsyncManager::~AsyncManager()
 
 void AsyncManager::Init(size_t numberOfThreads)
 {
+    // device requests mostly block on usbmuxd, keep at least the 4 workers we always had
+    if (numberOfThreads == 0)
+        numberOfThreads = std::max<size_t>(4, std::thread::hardware_concurrency());
+
     m_stop = false;
+    m_maxLongRunning = std::max<size_t>(1, numberOfThreads - 1);
+    for (size_t i = 0; i < numberOfThreads; ++i)
+    {
+        m_queues.emplace_back(new Worker());
+    }
     for (size_t i = 0; i < numberOfThreads; ++i)
     {
-        std::thread t(&AsyncManager::WorkerThread, this);
+        std::thread t(&AsyncManager::WorkerThread, this, i);
         m_workers.emplace_back(std::move(t));
     }
 }
 
-bool AsyncManager::StartAsyncRequest(const std::function<void(void)>& function)
+bool AsyncManager::StartAsyncRequest(const std::function<void(void)>& function, TaskPriority priority, const CancellationToken& token)
+{
+    return Enqueue(function, priority, token, nullptr);
+}
+
+bool AsyncManager::Enqueue(const std::function<void(void)>& function, TaskPriority priority, const CancellationToken& token, const std::function<void(void)>& dropped)
 {
+    bool accepted = false;
     {
         std::unique_lock<std::mutex> lock(m_queue_mutex);
-        m_tasks.emplace(function);
+        if (!m_stop && !m_queues.empty())
+        {
+            m_pending[priority]++;
+            accepted = true;
+        }
+    }
+    if (!accepted)
+    {
+        if (dropped)
+            dropped();
+        return false;
+    }
+
+    size_t index = t_manager == this ? t_worker : m_nextQueue++ % m_queues.size();
+    {
+        Worker& worker = *m_queues[index];
+        std::unique_lock<std::mutex> lock(worker.mutex);
+        worker.lanes[priority].push_back(Task{function, priority, token, std::chrono::steady_clock::now(), dropped});
     }
 
     m_condition.notify_one();
@@ -90,8 +215,7 @@ bool AsyncManager::StartAsyncRequest(const std::function<void(void)>& function)
 
 void AsyncManager::StopThreads()
 {
-    //ms todo WHAT do we do if we need to stop the threads ? do we still execute pending tasks ?
-    // discard them ?
+    // running tasks finish, the pending ones are dropped and their AsyncTask reports cancelled
     {
         std::unique_lock<std::mutex> lock(m_queue_mutex);
         m_stop = true;
@@ -110,8 +234,44 @@ void AsyncManager::StopThreads()
             //LOG_WARNING("%s | could not stop running task", __FUNCTION__);
         }
     }
+    m_workers.clear();
+
+    for (auto& worker : m_queues)
+    {
+        for (auto& lane : worker->lanes)
+        {
+            for (Task& task : lane)
+            {
+                if (task.dropped)
+                    task.dropped();
+            }
+            lane.clear();
+        }
+    }
 }
+
 bool AsyncManager::IsRunning()
 {
-    return !m_tasks.empty();
+    std::unique_lock<std::mutex> lock(m_queue_mutex);
+    for (int lane = TASK_INTERACTIVE; lane < TASK_PRIORITY_COUNT; ++lane)
+    {
+        if (m_pending[lane] || m_running[lane])
+            return true;
+    }
+    return false;
+}
+
+AsyncManager::Metrics AsyncManager::GetMetrics()
+{
+    std::unique_lock<std::mutex> lock(m_queue_mutex);
+    Metrics metrics = m_metrics;
+    metrics.workers = m_workers.size();
+    for (int lane = TASK_INTERACTIVE; lane < TASK_PRIORITY_COUNT; ++lane)
+    {
+        metrics.queued[lane] = m_pending[lane];
+        metrics.running += m_running[lane];
+        if (metrics.started[lane])
+            metrics.averageWaitMs[lane] = m_totalWaitMs[lane] / metrics.started[lane];
+    }
+    return metrics;
 }
@@ -1,38 +1,277 @@
 #pragma once
-#include <queue>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <thread>
 #include <functional>
+#include <optional>
+#include <type_traits>
+
+enum TaskPriority {
+    TASK_INTERACTIVE,
+    TASK_BULK,
+    TASK_BACKGROUND,
+    TASK_PRIORITY_COUNT
+};
+
+// copies share the flag, a task still queued when cancelled is dropped, a running one has to poll
+class CancellationToken
+{
+public:
+    CancellationToken() : m_cancelled(std::make_shared<std::atomic<bool>>(false)) {}
+    void Cancel() { m_cancelled->store(true); }
+    bool IsCancelled() const { return m_cancelled->load(); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> m_cancelled;
+};
+
+class AsyncManager;
+
+// result of AsyncManager::Run, copies share the state
+// a task dropped before it ran (cancelled or the pool stopped), or one that returned with its token cancelled, finishes as cancelled
+template<typename T>
+class AsyncTask
+{
+public:
+    using Value = std::conditional_t<std::is_void<T>::value, bool, T>;
+
+    AsyncTask() {}
+
+    bool IsValid() const { return m_state != nullptr; }
+    bool IsFinished() const;
+    bool IsCancelled() const;
+    CancellationToken Token() const { return m_state->token; }
+    void Cancel() { m_state->token.Cancel(); }
+    // blocks the caller, never wait from a pool worker on a task queued behind it
+    bool Wait(int timeout_ms = -1) const;
+    T Result() const;
+    // runs on the pool once this task finished, cancelled or not, the function checks IsCancelled() itself
+    // only a stopped pool skips it, the returned task then reports cancelled
+    template<typename F>
+    auto Then(F function, TaskPriority priority = TASK_INTERACTIVE) const -> AsyncTask<std::invoke_result_t<F, AsyncTask<T>>>;
+
+private:
+    friend class AsyncManager;
+    template<typename> friend class AsyncTask;
+
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable condition;
+        bool finished = false;
+        bool cancelled = false;
+        std::optional<Value> value;
+        std::vector<std::function<void(void)>> continuations;
+        CancellationToken token;
+        AsyncManager *manager = nullptr;
+    };
+
+    AsyncTask(AsyncManager *manager, const CancellationToken& token);
+    void Finish(std::optional<Value> value, bool cancelled);
+
+    std::shared_ptr<State> m_state;
+};
 
 class AsyncManager
 {
 
 public:
+    struct Metrics
+    {
+        size_t workers = 0;
+        size_t running = 0;
+        size_t queued[TASK_PRIORITY_COUNT] = {};
+        size_t started[TASK_PRIORITY_COUNT] = {};
+        size_t cancelled[TASK_PRIORITY_COUNT] = {};
+        // time spent queued before a worker picked the task up
+        double averageWaitMs[TASK_PRIORITY_COUNT] = {};
+        double maxWaitMs[TASK_PRIORITY_COUNT] = {};
+    };
+
     AsyncManager();
     AsyncManager(size_t numberOfThreads);
     ~AsyncManager();
 
-    void Init(size_t numberOfThreads);
-    bool StartAsyncRequest(const std::function<void(void)>& function);
+    // 0 sizes the pool from the hardware concurrency
+    void Init(size_t numberOfThreads = 0);
+    bool StartAsyncRequest(const std::function<void(void)>& function, TaskPriority priority = TASK_INTERACTIVE, const CancellationToken& token = CancellationToken());
     void StopThreads();
     bool IsRunning();
+    Metrics GetMetrics();
+
+    // function gets the token to poll while it runs, its return value becomes the task result
+    template<typename F>
+    auto Run(F function, TaskPriority priority = TASK_INTERACTIVE, const CancellationToken& token = CancellationToken()) -> AsyncTask<std::invoke_result_t<F, const CancellationToken&>>;
 
     static AsyncManager *Get();
     static void Destroy();
 
 private:
+    template<typename> friend class AsyncTask;
+
+    struct Task
+    {
+        std::function<void(void)> function;
+        TaskPriority priority;
+        CancellationToken token;
+        std::chrono::steady_clock::time_point queued;
+        // called instead of function when the task is not run
+        std::function<void(void)> dropped;
+        bool discarded = false;
+    };
+
+    // every worker owns one deque per lane, it pops its own from the back and steals from the front of the others
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> lanes[TASK_PRIORITY_COUNT];
+    };
 
-    void WorkerThread();
+    bool Enqueue(const std::function<void(void)>& function, TaskPriority priority, const CancellationToken& token, const std::function<void(void)>& dropped);
+    void WorkerThread(size_t index);
+    bool PopTask(size_t index, Task& task);
+    bool HasRunnableTask();
+    bool HasPendingTask();
 
     // need to keep track of threads so we can join them
     std::vector< std::thread > m_workers;
+    std::vector< std::unique_ptr<Worker> > m_queues;
+    std::atomic<size_t> m_nextQueue;
 
-    //queue of tasks to be consumed by threads
-    std::queue< std::function<void(void)> > m_tasks;
-
-    // synchronization
+    // synchronization, the counters are only touched under m_queue_mutex
     std::mutex				m_queue_mutex;
     std::condition_variable_any m_condition;
     bool m_stop;
+    size_t m_pending[TASK_PRIORITY_COUNT];
+    size_t m_running[TASK_PRIORITY_COUNT];
+    // bulk and background tasks may never take the last worker, the UI requests always get one
+    size_t m_maxLongRunning;
+    Metrics m_metrics;
+    double m_totalWaitMs[TASK_PRIORITY_COUNT];
     static AsyncManager *m_instance;
 };
+
+template<typename T>
+AsyncTask<T>::AsyncTask(AsyncManager *manager, const CancellationToken& token)
+    : m_state(std::make_shared<State>())
+{
+    m_state->token = token;
+    m_state->manager = manager;
+}
+
+template<typename T>
+bool AsyncTask<T>::IsFinished() const
+{
+    std::unique_lock<std::mutex> lock(m_state->mutex);
+    return m_state->finished;
+}
+
+template<typename T>
+bool AsyncTask<T>::IsCancelled() const
+{
+    std::unique_lock<std::mutex> lock(m_state->mutex);
+    return m_state->cancelled;
+}
+
+template<typename T>
+bool AsyncTask<T>::Wait(int timeout_ms) const
+{
+    std::unique_lock<std::mutex> lock(m_state->mutex);
+    if (timeout_ms < 0)
+    {
+        m_state->condition.wait(lock, [this] { return m_state->finished; });
+        return true;
+    }
+    return m_state->condition.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return m_state->finished; });
+}
+
+template<typename T>
+T AsyncTask<T>::Result() const
+{
+    Wait();
+    if constexpr (!std::is_void<T>::value)
+    {
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        return m_state->value ? *m_state->value : T();
+    }
+}
+
+template<typename T>
+void AsyncTask<T>::Finish(std::optional<Value> value, bool cancelled)
+{
+    std::vector<std::function<void(void)>> continuations;
+    {
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        m_state->value = std::move(value);
+        m_state->cancelled = cancelled;
+        m_state->finished = true;
+        continuations.swap(m_state->continuations);
+    }
+    m_state->condition.notify_all();
+    for (auto& continuation : continuations)
+        continuation();
+}
+
+template<typename T>
+template<typename F>
+auto AsyncTask<T>::Then(F function, TaskPriority priority) const -> AsyncTask<std::invoke_result_t<F, AsyncTask<T>>>
+{
+    using R = std::invoke_result_t<F, AsyncTask<T>>;
+    AsyncTask<T> parent = *this;
+    AsyncTask<R> next(m_state->manager, m_state->token);
+    auto schedule = [parent, next, function, priority]() {
+        parent.m_state->manager->Enqueue([parent, next, function]() mutable {
+            if constexpr (std::is_void<R>::value)
+            {
+                function(parent);
+                next.Finish(true, false);
+            }
+            else
+            {
+                next.Finish(function(parent), false);
+            }
+        }, priority, CancellationToken(), [next]() mutable {
+            next.Finish(std::nullopt, true);
+        });
+    };
+
+    {
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        if (!m_state->finished)
+        {
+            m_state->continuations.push_back(schedule);
+            return next;
+        }
+    }
+    schedule();
+    return next;
+}
+
+template<typename F>
+auto AsyncManager::Run(F function, TaskPriority priority, const CancellationToken& token) -> AsyncTask<std::invoke_result_t<F, const CancellationToken&>>
+{
+    using R = std::invoke_result_t<F, const CancellationToken&>;
+    AsyncTask<R> task(this, token);
+    Enqueue([task, function, token]() mutable {
+        if constexpr (std::is_void<R>::value)
+        {
+            function(token);
+            task.Finish(true, token.IsCancelled());
+        }
+        else
+        {
+            // a body that returned early because of the token reports cancelled too
+            R result = function(token);
+            task.Finish(std::move(result), token.IsCancelled());
+        }
+    }, priority, token, [task]() mutable {
+        task.Finish(std::nullopt, true);
+    });
+    return task;
+}
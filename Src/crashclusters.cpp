@@ -0,0 +1,216 @@
+#include "crashclusters.h"
+#include "utils.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QRegularExpression>
+#include <QCryptographicHash>
+
+const QRegularExpression kOFFSET_REGEX("\\s*\\+\\s*[0-9]+\\s*$");
+const QRegularExpression kADDRESS_REGEX("0x[0-9a-fA-F]+");
+
+CrashClusters *CrashClusters::m_instance = nullptr;
+CrashClusters *CrashClusters::Get()
+{
+    if(!m_instance)
+        m_instance = new CrashClusters();
+    return m_instance;
+}
+
+void CrashClusters::Destroy()
+{
+    if (m_instance)
+    {
+        m_instance->Save();
+        delete m_instance;
+        m_instance = nullptr;
+    }
+}
+
+CrashClusters::CrashClusters()
+    : m_loaded(false)
+    , m_dirty(false)
+{
+}
+
+QString CrashClusters::Add(const QString &crashlogPath, const SymbolicatedData &data)
+{
+    QStringList frames = NormalizedFrames(data);
+    if (frames.isEmpty())
+        return "";
+    QString signature = Signature(frames);
+    QString path = QFileInfo(crashlogPath).absoluteFilePath();
+    QDateTime seen = QFileInfo(crashlogPath).lastModified();
+
+    QMutexLocker locker(&m_mutex);
+    ReadFromFile();
+    auto known = m_reports.constFind(path);
+    if (known != m_reports.constEnd() && known.value() == signature)
+        return signature;
+
+    // re-symbolicated with a better dSYM, move it to the new bucket
+    if (known != m_reports.constEnd())
+    {
+        Bucket& old = m_buckets[known.value()];
+        old.reports.removeOne(path);
+        if (--old.count <= 0)
+            m_buckets.remove(known.value());
+    }
+
+    Bucket& bucket = m_buckets[signature];
+    if (bucket.count == 0)
+    {
+        bucket.signature = signature;
+        bucket.frames = frames;
+        bucket.firstSeen = seen;
+        bucket.lastSeen = seen;
+    }
+    bucket.count++;
+    bucket.reports << path;
+    if (seen < bucket.firstSeen)
+        bucket.firstSeen = seen;
+    if (seen > bucket.lastSeen)
+        bucket.lastSeen = seen;
+    m_reports[path] = signature;
+    m_dirty = true;
+    return signature;
+}
+
+bool CrashClusters::Lookup(const QString &signature, Bucket &bucket_out)
+{
+    QMutexLocker locker(&m_mutex);
+    ReadFromFile();
+    auto it = m_buckets.constFind(signature);
+    if (it == m_buckets.constEnd())
+        return false;
+    bucket_out = it.value();
+    return true;
+}
+
+QString CrashClusters::SignatureOf(const QString &crashlogPath)
+{
+    QMutexLocker locker(&m_mutex);
+    ReadFromFile();
+    return m_reports.value(QFileInfo(crashlogPath).absoluteFilePath());
+}
+
+QList<CrashClusters::Bucket> CrashClusters::GetBuckets()
+{
+    QMutexLocker locker(&m_mutex);
+    ReadFromFile();
+    QList<Bucket> buckets = m_buckets.values();
+    std::sort(buckets.begin(), buckets.end(), [](const Bucket& a, const Bucket& b) {
+        return a.count != b.count ? a.count > b.count : a.lastSeen > b.lastSeen;
+    });
+    return buckets;
+}
+
+void CrashClusters::Save()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_dirty)
+        return;
+
+    QJsonArray buckets;
+    foreach (const Bucket& bucket, m_buckets)
+    {
+        QJsonObject item;
+        item["signature"] = bucket.signature;
+        item["frames"] = QJsonArray::fromStringList(bucket.frames);
+        item["count"] = bucket.count;
+        item["firstSeen"] = bucket.firstSeen.toString(Qt::ISODate);
+        item["lastSeen"] = bucket.lastSeen.toString(Qt::ISODate);
+        item["reports"] = QJsonArray::fromStringList(bucket.reports);
+        buckets.append(item);
+    }
+
+    QDir().mkpath(GetDirectory(DIRECTORY_TYPE::LOCALDATA));
+    QSaveFile file(GetDirectory(DIRECTORY_TYPE::LOCALDATA) + "crashclusters.json");
+    if (file.open(QIODevice::WriteOnly))
+    {
+        file.write(QJsonDocument(buckets).toJson(QJsonDocument::Compact));
+        if (file.commit())
+            m_dirty = false;
+    }
+}
+
+QStringList CrashClusters::NormalizedFrames(const SymbolicatedData &data, int maxFrames)
+{
+    if (data.stackTraces.isEmpty())
+        return QStringList();
+
+    // the crashed thread, an exception backtrace wins since it points at the throw site
+    const StackTrace* crashed = nullptr;
+    foreach (const StackTrace& stacktrace, data.stackTraces)
+    {
+        if (stacktrace.threadName.contains("Exception Backtrace", Qt::CaseInsensitive) && !stacktrace.lines.isEmpty())
+        {
+            crashed = &stacktrace;
+            break;
+        }
+        if (stacktrace.crashed && !crashed)
+            crashed = &stacktrace;
+    }
+    if (!crashed)
+        crashed = &data.stackTraces.first();
+
+    QStringList frames;
+    foreach (const StackLine& stackline, crashed->lines)
+    {
+        if (frames.count() >= maxFrames)
+            break;
+        // reports parsed before the exception backtrace kept the symbol in line
+        frames << stackline.binary + "`" + NormalizeFunction(stackline.function.isEmpty() ? stackline.line : stackline.function);
+    }
+    return frames;
+}
+
+QString CrashClusters::Signature(const QStringList &frames)
+{
+    QByteArray hash = QCryptographicHash::hash(frames.join('\n').toUtf8(), QCryptographicHash::Sha1);
+    return hash.toHex().left(16);
+}
+
+QString CrashClusters::NormalizeFunction(QString function)
+{
+    // slide and offsets differ per report, only the symbol identifies the frame
+    function.remove(kOFFSET_REGEX);
+    function.remove(kADDRESS_REGEX);
+    function = function.simplified();
+    return function.isEmpty() ? "???" : function;
+}
+
+void CrashClusters::ReadFromFile()
+{
+    if (m_loaded)
+        return;
+    m_loaded = true;
+
+    QFile file(GetDirectory(DIRECTORY_TYPE::LOCALDATA) + "crashclusters.json");
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    QJsonArray buckets = QJsonDocument::fromJson(file.readAll()).array();
+    file.close();
+
+    foreach (const auto& value, buckets)
+    {
+        QJsonObject item = value.toObject();
+        Bucket bucket;
+        bucket.signature = item["signature"].toString();
+        bucket.count = item["count"].toInt();
+        bucket.firstSeen = QDateTime::fromString(item["firstSeen"].toString(), Qt::ISODate);
+        bucket.lastSeen = QDateTime::fromString(item["lastSeen"].toString(), Qt::ISODate);
+        foreach (const auto& frame, item["frames"].toArray())
+            bucket.frames << frame.toString();
+        foreach (const auto& report, item["reports"].toArray())
+        {
+            bucket.reports << report.toString();
+            m_reports[report.toString()] = bucket.signature;
+        }
+        m_buckets[bucket.signature] = bucket;
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef CRASHCLUSTERS_H
+#define CRASHCLUSTERS_H
+
+#include <QString>
+#include <QStringList>
+#include <QDateTime>
+#include <QMutex>
+#include <QMap>
+#include <QHash>
+#include "crashsymbolicator.h"
+
+class CrashClusters
+{
+public:
+    static CrashClusters *Get();
+    static void Destroy();
+    CrashClusters();
+
+    struct Bucket
+    {
+        QString signature;
+        QStringList frames;
+        int count = 0;
+        QDateTime firstSeen;
+        QDateTime lastSeen;
+        QStringList reports;
+    };
+
+    QString Add(const QString& crashlogPath, const SymbolicatedData& data);
+    bool Lookup(const QString& signature, Bucket& bucket_out);
+    QString SignatureOf(const QString& crashlogPath);
+    QList<Bucket> GetBuckets();
+    void Save();
+
+    static QStringList NormalizedFrames(const SymbolicatedData& data, int maxFrames = 5);
+    static QString Signature(const QStringList& frames);
+
+private:
+    static QString NormalizeFunction(QString function);
+    void ReadFromFile();
+
+    static CrashClusters *m_instance;
+    QHash<QString, Bucket> m_buckets;
+    // crashlog path -> signature, a report is only counted once
+    QHash<QString, QString> m_reports;
+    bool m_loaded;
+    bool m_dirty;
+    QMutex m_mutex;
+};
+
+#endif // CRASHCLUSTERS_H
@@ -4,16 +4,43 @@
 #include <QFileInfo>
 #include <QSaveFile>
 #include <QDir>
-#include <fstream>
+#include <QDateTime>
+#include <QSet>
+#include <memory>
+#include <mutex>
+#include <atomic>
 #include "utility/CDirectory.h"
 #include "utils.h"
+#include "dsymindex.h"
+#include "crashclusters.h"
+#include "inliningcache.h"
+#include "userconfigs.h"
 #include "CMachOW.h"
 
 const QString kSPACE_TAB_SEPARATOR = " \t";
 const QString kPLUS_SPACE_SEPARATOR = "+ ";
 const char kSPACE = ' ';
+const QString kTHREAD_PREFIX = "Thread ";
+const QRegularExpression kTHREAD_NAME_REGEX("Thread [0-9]+ name:");
+const QRegularExpression kTHREAD_REGEX("Thread [0-9]+");
+const QRegularExpression kSOURCE_LINE_REGEX("\\([\\S]*:[0-9]+\\)");
+
+static QString ImageNameOf(const QString& line)
+{
+    // second whitespace separated column of a frame line, same as split("\\s+").at(1)
+    qsizetype start = 0;
+    while (start < line.size() && !line[start].isSpace())
+        start++;
+    while (start < line.size() && line[start].isSpace())
+        start++;
+    qsizetype end = start;
+    while (end < line.size() && !line[end].isSpace())
+        end++;
+    return line.mid(start, end - start);
+}
 
 CrashSymbolicator *CrashSymbolicator::m_instance = nullptr;
+QMutex CrashSymbolicator::m_systemSymbolsMutex;
 CrashSymbolicator *CrashSymbolicator::Get()
 {
     if(!m_instance)
@@ -32,11 +59,18 @@ void CrashSymbolicator::Destroy()
 
 CrashSymbolicator::CrashSymbolicator()
     : m_thread(new QThread())
+    , m_batchPool(nullptr)
 {
     connect(m_thread, SIGNAL(started()), SLOT(doWork()));
     moveToThread(m_thread);
 }
 
+CrashSymbolicator::~CrashSymbolicator()
+{
+    if (m_batchPool)
+        delete m_batchPool;
+}
+
 void CrashSymbolicator::Process(QString crashlogPath, QString dsymDir)
 {
     if (m_thread->isRunning()) {
@@ -51,14 +85,10 @@ void CrashSymbolicator::Process(QString crashlogPath, QString dsymDir)
 void CrashSymbolicator::doWork()
 {
     SymbolicatedData data;
-    QString out;
-    QString oldstyle = ConvertToOldStyle(m_crashlogPath);
-    if (!oldstyle.isEmpty())
-    {
-        m_crashlogPath = oldstyle;
-    }
+    QJsonDocument ipsHeader, ipsPayload;
+    bool isIps = ReadIps(m_crashlogPath, ipsHeader, ipsPayload);
 
-    bool result = CSearchMachO::Search(m_crashlogPath.toStdWString().c_str(), *this);
+    bool result = isIps || CSearchMachO::Search(m_crashlogPath.toStdWString().c_str(), *this);
     if (!result)
     {
         data.rawString = "Crashlog not found!";
@@ -86,40 +116,77 @@ void CrashSymbolicator::doWork()
         return;
     }
 
-    bool inlining = false;
-    std::map<std::wstring, std::wstring> linkNameOfLibWithUUID = m_crashlog->GetLinkMap();
+    auto progress = [this](unsigned int progress){
+        emit SymbolicateResult2(progress, SymbolicatedData());
+    };
+    if (isIps)
+    {
+        result = SymbolicateIps(ipsHeader, ipsPayload, m_dsym, nullptr, m_crashlogPath, m_dsymPath, data, progress);
+    }
+    else
+    {
+        result = Symbolicate(m_crashlog, m_dsym, nullptr, m_crashlogPath, m_dsymPath, data, progress);
+        if (result)
+            m_dsym->GetMachO(m_crashlog->GetUUID())->CleanUpInliningInfo();
+    }
+    if (result)
+    {
+        CrashClusters::Get()->Add(m_crashlogPath, data);
+        CrashClusters::Get()->Save();
+        InliningCache::Get()->Flush();
+    }
+    emit SymbolicateResult2(100, data, !result);
+    m_thread->quit();
+    m_thread->wait();
+}
+
+bool CrashSymbolicator::Symbolicate(CMachOCrashLogW *crashlog, CMachODSymW *dsym, QMutex *dsymLock, const QString &crashlogPath, const QString &dsymPath, SymbolicatedData &data, const std::function<void (unsigned int)> &progress)
+{
+    QString out;
+    bool inlining = UserConfigs::Get()->GetData("SymbolicateInlining", false);
+    std::map<std::wstring, std::wstring> linkNameOfLibWithUUID = crashlog->GetLinkMap();
     QString line = "";
-    QString name = QString::fromStdWString(m_dsym->GetName());
+    QString name = QString::fromStdWString(dsym->GetName());
 
     CMachOW* crashed_macho = NULL;
     try {
-        crashed_macho = m_dsym->GetMachO(m_crashlog->GetUUID());
+        QMutexLocker locker(dsymLock);
+        crashed_macho = dsym->GetMachO(crashlog->GetUUID());
     } catch (const char* messages) {
         data.rawString = QString("Crashlog invalid! (%1)\n"
                                  "Please check your crashlog and dsym or try to symbolicate or debug it in xcode...\n"
                                  "\nLast crashlog: %2\n"
-                                 "\nLast dsym: %3\n").arg(messages).arg(m_crashlogPath).arg(m_dsymPath);
-        emit SymbolicateResult2(100, data, true);
-        m_thread->quit();
-        m_thread->wait();
-        return;
+                                 "\nLast dsym: %3\n").arg(messages).arg(crashlogPath).arg(dsymPath);
+        return false;
     }
-    std::ifstream infile(m_crashlogPath.toStdString());
-    quint64 lineTotal = std::count(std::istreambuf_iterator<char>(infile), std::istreambuf_iterator<char>(), '\n');
-    quint64 lineCount = 0;
-    std::string cline;
+    QFile infile(crashlogPath);
+    if (!infile.open(QIODevice::ReadOnly))
+    {
+        data.rawString = "Unable to read " + crashlogPath;
+        return false;
+    }
+    qint64 bytesTotal = infile.size();
+    qint64 bytesRead = 0;
+    unsigned int lastProgress = 0;
     StackTrace stacktrace;
-    infile.seekg(0);
-    while (std::getline(infile, cline))
+    out.reserve(bytesTotal + bytesTotal / 2);
+    while (!infile.atEnd())
     {
-        line = QString(cline.c_str());
+        QByteArray cline = infile.readLine();
+        bytesRead += cline.size();
+        if (cline.endsWith('\n'))
+            cline.chop(1);
+        line = QString::fromUtf8(cline);
         if (!line.isNull())
         {
-            QString threadname = FindRegex(line, "Thread [0-9]+ name:");
-            if (!threadname.isEmpty())
-                threadname = line.trimmed();
-            else
-                threadname = FindRegex(line, "Thread [0-9]+");
+            QString threadname;
+            if (line.contains(kTHREAD_PREFIX))
+            {
+                if (kTHREAD_NAME_REGEX.match(line).hasMatch())
+                    threadname = line.trimmed();
+                else
+                    threadname = kTHREAD_REGEX.match(line).captured(0);
+            }
 
             if (!threadname.isEmpty() && !stacktrace.threadName.contains(threadname, Qt::CaseInsensitive))
             {
@@ -129,6 +196,8 @@ void CrashSymbolicator::doWork()
                 stacktrace = StackTrace();
                 stacktrace.threadName = threadname;
             }
+            if (!threadname.isEmpty() && line.contains(" Crashed:"))
+                stacktrace.crashed = true;
 
             if (IsUnsymbolicatedLine(line))
             {
@@ -148,38 +217,23 @@ void CrashSymbolicator::doWork()
 
                 if (line.indexOf(name) >= 0)
                 {
-                    if (inlining)
-                    {
-                        symbol = QString::fromStdWString(crashed_macho->GetInliningInfo(addr64));
-                    }
-                    else
-                    {
-                        symbol = QString::fromStdWString(m_dsym->GetSymbolNameAt(m_crashlog->GetUUID(), addr64));
-                    }
+                    symbol = GetAppSymbol(crashlog->GetUUID(), dsym, dsymLock, crashed_macho, addr64, inlining);
                     line = line.mid(0, replace_start) + " " + symbol + " " + line.mid(replace_end);
                     stackline.binary = name;
                 }
                 else
                 {
-                    stackline.binary = line.split(QRegularExpression("\\s+")).at(1);
+                    stackline.binary = ImageNameOf(line);
                     symbol = line.mid(replace_start);
-                    for (const auto& linkname : linkNameOfLibWithUUID)
+                    QString systemSymbol = GetSystemSymbol(linkNameOfLibWithUUID, stackline.binary, addr64, stackline.binary);
+                    if (!systemSymbol.isEmpty())
                     {
-                        if(GetSystemSymbols() != nullptr)
-                        {
-                            //CMachOW* macho = m_dsym->GetMachO(m_crashlog->GetUUID());
-                            QString systemSymbol = QString::fromStdWString(GetSystemSymbols()->GetSymbolNameAt(linkname.second, addr64));
-                            if (!(systemSymbol.isNull() || systemSymbol.isEmpty()))
-                            {
-                                line = line.mid(0, replace_start) + " " + systemSymbol + " " + line.mid(replace_end);
-                                stackline.binary = QString::fromStdWString(linkname.first);
-                                symbol = systemSymbol;
-                            }
-                        }
+                        line = line.mid(0, replace_start) + " " + systemSymbol + " " + line.mid(replace_end);
+                        symbol = systemSymbol;
                     }
                 }
 
-                QString symbol_line = FindRegex(symbol, "\\([\\S]*:[0-9]+\\)");
+                QString symbol_line = kSOURCE_LINE_REGEX.match(symbol).captured(0);
                 if (symbol_line.isEmpty())
                 {
                     stackline.function = symbol;
@@ -206,26 +260,19 @@ void CrashSymbolicator::doWork()
                     QString hexvalue = QString("0x%1").arg(addr64, 8, 16, QLatin1Char( '0' ));
                     QString symbol = "<unresolved>", image = "<unresolved>", _template = "";
 
-                    if (addr64 >= m_crashlog->Start() && addr64 < m_crashlog->End())
+                    if (addr64 >= crashlog->Start() && addr64 < crashlog->End())
                     {
-                        if (inlining)
-                        {
-                            symbol = QString::fromStdWString(crashed_macho->GetInliningInfo(addr64 - m_crashlog->Start()));
-                        }
-                        else
-                        {
-                            symbol = QString::fromStdWString(m_dsym->GetSymbolNameAt(m_crashlog->GetUUID(), addr64 - m_crashlog->Start()));
-                        }
-                        image = QString::fromStdWString(m_crashlog->GetImageName());
+                        symbol = GetAppSymbol(crashlog->GetUUID(), dsym, dsymLock, crashed_macho, addr64 - crashlog->Start(), inlining);
+                        image = QString::fromStdWString(crashlog->GetImageName());
                     }
                     _template = QString("%1%2\t%3 %4").arg(i, -4).arg(image).arg(hexvalue).arg(symbol);
                     result += _template + "\n";
 
                     stackline.binary = image;
-                    QString symbol_line = FindRegex(symbol, "\\([\\S]*:[0-9]+\\)");
+                    QString symbol_line = kSOURCE_LINE_REGEX.match(symbol).captured(0);
                     if (symbol_line.isEmpty())
                     {
-                        stackline.line = symbol;
+                        stackline.function = symbol;
                     }
                     else
                     {
@@ -245,93 +292,414 @@ void CrashSymbolicator::doWork()
                 if (replace_start >= 0 && start > replace_start && replace_end > start)
                 {
                     StackLine stackline;
-                    stackline.binary = line.split(QRegularExpression("\\s+")).at(1);
+                    stackline.binary = ImageNameOf(line);
                     stackline.function = line.mid(replace_start);
                     stacktrace.lines.append(stackline);
                 }
             }
         }
-        out.append(line + "\n");
-        lineCount += 1;
-        emit SymbolicateResult2((lineCount * 100) / lineTotal, SymbolicatedData());
+        out.append(line);
+        out.append('\n');
+
+        // file size drives the progress, only report when the percentage moves
+        unsigned int percentage = bytesTotal > 0 ? (unsigned int)((bytesRead * 100) / bytesTotal) : 100;
+        if (progress && percentage != lastProgress && percentage < 100)
+        {
+            lastProgress = percentage;
+            progress(percentage);
+        }
     }
-    crashed_macho->CleanUpInliningInfo();
+    if (!stacktrace.threadName.isEmpty() && !stacktrace.lines.isEmpty())
+        data.stackTraces.append(stacktrace);
     data.rawString = out;
-    emit SymbolicateResult2(100, data);
-    m_thread->quit();
-    m_thread->wait();
+    return true;
 }
 
-QString CrashSymbolicator::ConvertToOldStyle(QString crashlogPath)
+class MachOCollector : public CSearchMachO::ISender
 {
-    QFile inputFile(crashlogPath);
-    QString header, content;
-    if (inputFile.open(QIODevice::ReadOnly))
+public:
+    QList<CMachOCrashLogW*> crashlogs;
+    QList<CMachODSymW*> dsyms;
+
+protected:
+    void onFind(CMachOCrashLog& crashlog) override { crashlogs.append(new CMachOCrashLogW(crashlog)); }
+    void onFind(CMachODSym& dsym) override { dsyms.append(new CMachODSymW(dsym)); }
+    void onFind(CMachOApplication& app) override {}
+    void onFind(CMachODyLib& dylib) override {}
+};
+
+struct CrashSymbolicator::BatchDsym
+{
+    QString path;
+    CMachODSymW* dsym;
+    QMutex mutex;
+};
+
+struct CrashSymbolicator::BatchState
+{
+    QList<std::shared_ptr<BatchDsym>> dsyms;
+    QMap<QString, std::shared_ptr<BatchDsym>> matched;
+    QJsonArray entries;
+    QMutex mutex;
+    std::atomic<int> done;
+    int total;
+    int failed;
+};
+
+void CrashSymbolicator::ProcessBatch(QString crashlogDir, QStringList dsymPaths)
+{
+    if (!m_batchPool)
+        m_batchPool = new AsyncManager(qMax(2u, std::thread::hardware_concurrency()));
+
+    m_batchPool->StartAsyncRequest([this, crashlogDir, dsymPaths]() {
+        auto state = std::make_shared<BatchState>();
+        foreach (const QString& dsymPath, dsymPaths)
+        {
+            emit BatchProgress(0, 0, "Loading " + dsymPath + "...");
+            MachOCollector collector;
+            if (QFileInfo(dsymPath).isFile())
+                collector.dsyms.append(new CMachODSymW(CMachODSym(dsymPath.toStdWString(), dsymPath.toStdWString())));
+            else
+                CSearchMachO::Search(dsymPath.toStdWString().c_str(), collector);
+
+            foreach (CMachODSymW* dsym, collector.dsyms)
+            {
+                auto loaded = std::make_shared<BatchDsym>();
+                loaded->path = dsymPath;
+                loaded->dsym = dsym;
+                state->dsyms.append(loaded);
+            }
+        }
+
+        QStringList crashlogs = FindFiles(crashlogDir, QStringList() << "*.ips" << "*.crash");
+        state->done = 0;
+        state->total = crashlogs.count();
+        state->failed = 0;
+        if (state->total == 0)
+        {
+            foreach (const auto& loaded, state->dsyms)
+                delete loaded->dsym;
+            emit BatchFinished("", 0, state->total);
+            return;
+        }
+
+        QDir().mkpath(GetDirectory(DIRECTORY_TYPE::SYMBOLICATED));
+        QSet<QString> outputs;
+        foreach (const QString& crashlogPath, crashlogs)
+        {
+            // the same report name can show up in several folders or as both .ips and .crash
+            QString name = QFileInfo(crashlogPath).completeBaseName();
+            QString unique = name;
+            for (int n = 2; outputs.contains(unique.toLower()); n++)
+                unique = name + "_" + QString::number(n);
+            outputs.insert(unique.toLower());
+            QString output = GetDirectory(DIRECTORY_TYPE::SYMBOLICATED) + unique + ".crash";
+
+            m_batchPool->StartAsyncRequest([this, state, crashlogPath, output]() {
+                QJsonObject entry = SymbolicateBatchItem(state, crashlogPath, output);
+                bool finished = false;
+                {
+                    QMutexLocker locker(&state->mutex);
+                    state->entries.append(entry);
+                    if (entry["error"].isString())
+                        state->failed++;
+                    finished = (++state->done == state->total);
+                }
+                emit BatchProgress(state->done, state->total, QFileInfo(crashlogPath).fileName() + (entry["error"].isString() ? " : " + entry["error"].toString() : " symbolicated."));
+                if (finished)
+                    FinishBatch(state);
+            });
+        }
+    });
+}
+
+QJsonObject CrashSymbolicator::SymbolicateBatchItem(std::shared_ptr<BatchState> state, QString crashlogPath, QString output)
+{
+    QJsonObject entry;
+    entry["crashlog"] = crashlogPath;
+
+    QJsonDocument ipsHeader, ipsPayload;
+    bool isIps = ReadIps(crashlogPath, ipsHeader, ipsPayload);
+
+    MachOCollector collector;
+    CMachOCrashLogW* crashlog = nullptr;
+    QString uuid;
+    if (isIps)
+    {
+        uuid = GetIpsMainUUID(ipsPayload);
+    }
+    else
     {
-       QTextStream in(&inputFile);
-       while (!in.atEnd())
-       {
-           if (header.isEmpty())
-           {
-               header = in.readLine();
-           }
-           else
-           {
-               content += in.readLine() + "\n";
-           }
-       }
-       inputFile.close();
+        if (!CSearchMachO::Search(crashlogPath.toStdWString().c_str(), collector) || collector.crashlogs.isEmpty())
+        {
+            entry["error"] = "Crashlog not found!";
+            return entry;
+        }
+        crashlog = collector.crashlogs.first();
+        uuid = QString::fromStdWString(crashlog->GetUUID());
     }
+    entry["uuid"] = uuid;
 
+    std::shared_ptr<BatchDsym> match;
+    {
+        QMutexLocker locker(&state->mutex);
+        match = state->matched.value(uuid);
+    }
+    if (!match)
+    {
+        QList<std::shared_ptr<BatchDsym>> dsyms;
+        {
+            QMutexLocker locker(&state->mutex);
+            dsyms = state->dsyms;
+        }
+        foreach (const auto& loaded, dsyms)
+        {
+            QMutexLocker locker(&loaded->mutex);
+            try {
+                loaded->dsym->GetMachO(uuid.toStdWString());
+                match = loaded;
+                break;
+            } catch (const char*) {
+            }
+        }
+        if (!match)
+            match = LoadIndexedDsym(state, uuid);
+        QMutexLocker locker(&state->mutex);
+        if (match)
+            state->matched[uuid] = match;
+    }
+
+    if (!match)
+    {
+        entry["error"] = "No dSYM matches " + uuid;
+    }
+    else
+    {
+        SymbolicatedData data;
+        entry["dsym"] = match->path;
+        bool result = isIps ? SymbolicateIps(ipsHeader, ipsPayload, match->dsym, &match->mutex, crashlogPath, match->path, data)
+                            : Symbolicate(crashlog, match->dsym, &match->mutex, crashlogPath, match->path, data);
+        if (result)
+        {
+            QSaveFile file(output);
+            if (file.open(QIODevice::WriteOnly))
+            {
+                file.write(data.rawString.toUtf8());
+                file.commit();
+                entry["output"] = output;
+                entry["threads"] = data.stackTraces.count();
+                entry["signature"] = CrashClusters::Get()->Add(crashlogPath, data);
+            }
+            else
+            {
+                entry["error"] = "Unable to write " + output;
+            }
+        }
+        else
+        {
+            entry["error"] = data.rawString;
+        }
+    }
+
+    foreach (CMachOCrashLogW* found, collector.crashlogs)
+        delete found;
+    return entry;
+}
+
+std::shared_ptr<CrashSymbolicator::BatchDsym> CrashSymbolicator::LoadIndexedDsym(std::shared_ptr<BatchState> state, QString uuid)
+{
+    DsymIndex::Entry indexed;
+    if (!DsymIndex::Get()->Lookup(uuid, indexed))
+        return nullptr;
+
+    MachOCollector collector;
+    if (QFileInfo(indexed.path).isFile())
+        collector.dsyms.append(new CMachODSymW(CMachODSym(indexed.path.toStdWString(), indexed.path.toStdWString())));
+    else
+        CSearchMachO::Search(indexed.path.toStdWString().c_str(), collector);
+
+    std::shared_ptr<BatchDsym> match;
+    foreach (CMachODSymW* dsym, collector.dsyms)
+    {
+        auto loaded = std::make_shared<BatchDsym>();
+        loaded->path = indexed.path;
+        loaded->dsym = dsym;
+        try {
+            dsym->GetMachO(uuid.toStdWString());
+            match = loaded;
+        } catch (const char*) {
+        }
+        QMutexLocker locker(&state->mutex);
+        state->dsyms.append(loaded);
+    }
+    return match;
+}
+
+void CrashSymbolicator::FinishBatch(std::shared_ptr<BatchState> state)
+{
+    foreach (const auto& loaded, state->dsyms)
+    {
+        foreach (const QString& uuid, state->matched.keys(loaded))
+            loaded->dsym->GetMachO(uuid.toStdWString())->CleanUpInliningInfo();
+        delete loaded->dsym;
+    }
+
+    // buckets hit by this batch, with their counts across every report seen so far
+    QJsonArray clusters;
+    QStringList signatures;
+    foreach (const auto& item, state->entries)
+    {
+        QString signature = item["signature"].toString();
+        CrashClusters::Bucket bucket;
+        if (signature.isEmpty() || signatures.contains(signature) || !CrashClusters::Get()->Lookup(signature, bucket))
+            continue;
+        signatures << signature;
+        QJsonObject cluster;
+        cluster["signature"] = signature;
+        cluster["count"] = bucket.count;
+        cluster["firstSeen"] = bucket.firstSeen.toString(Qt::ISODate);
+        cluster["lastSeen"] = bucket.lastSeen.toString(Qt::ISODate);
+        cluster["frames"] = QJsonArray::fromStringList(bucket.frames);
+        clusters.append(cluster);
+    }
+    CrashClusters::Get()->Save();
+    InliningCache::Get()->Flush();
+
+    QJsonObject summary;
+    summary["total"] = state->total;
+    summary["failed"] = state->failed;
+    summary["date"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    summary["items"] = state->entries;
+    summary["clusters"] = clusters;
+
+    QString indexPath = GetDirectory(DIRECTORY_TYPE::SYMBOLICATED) + "index.json";
+    QSaveFile file(indexPath);
+    if (file.open(QIODevice::WriteOnly))
+    {
+        file.write(QJsonDocument(summary).toJson(QJsonDocument::Indented));
+        file.commit();
+    }
+    emit BatchFinished(indexPath, state->total - state->failed, state->failed);
+}
+
+bool CrashSymbolicator::ReadIps(QString crashlogPath, QJsonDocument &ipsHeader, QJsonDocument &payload)
+{
+    QFile inputFile(crashlogPath);
+    if (!inputFile.open(QIODevice::ReadOnly))
+        return false;
+
+    // legacy reports fail on the first line, no need to read the rest
     QJsonParseError error;
-    QJsonDocument headerDoc = QJsonDocument::fromJson(header.toUtf8(), &error);
-    if (error.error != QJsonParseError::NoError) return "";
-    QJsonDocument contentDoc = QJsonDocument::fromJson(content.toUtf8(), &error);
-    if (error.error != QJsonParseError::NoError) return "";
-
-    QFileInfo info(crashlogPath);
-    QDir().mkpath(GetDirectory(DIRECTORY_TYPE::TEMP));
-    QString filepath = GetDirectory(DIRECTORY_TYPE::TEMP) + "/" + info.baseName() + "_legacy." + info.completeSuffix();
-    QString oldStyle = header + "\n" + ConvertToOldStyle(headerDoc, contentDoc);
-    QFile f(filepath);
-    if (f.open(QIODevice::ReadWrite))
+    ipsHeader = QJsonDocument::fromJson(inputFile.readLine(), &error);
+    if (error.error != QJsonParseError::NoError || !ipsHeader.isObject())
+        return false;
+    payload = QJsonDocument::fromJson(inputFile.readAll(), &error);
+    return error.error == QJsonParseError::NoError && payload.isObject();
+}
+
+QString CrashSymbolicator::GetIpsMainUUID(const QJsonDocument &payload)
+{
+    QJsonArray binaryImages = payload["usedImages"].toArray();
+    QString procPath = payload["procPath"].toString();
+    foreach (const auto& image, binaryImages)
     {
-        QTextStream stream(&f);
-        stream << oldStyle;
-        f.close();
-        return filepath;
+        if (image["path"].toString() == procPath)
+            return image["uuid"].toString("").remove('-');
     }
-    return "";
+    return binaryImages.isEmpty() ? "" : binaryImages[0]["uuid"].toString("").remove('-');
 }
 
-QString CrashSymbolicator::ConvertToOldStyle(const QJsonDocument& ipsHeader, const QJsonDocument& payload)
+bool CrashSymbolicator::SymbolicateIps(const QJsonDocument &ipsHeader, const QJsonDocument &payload, CMachODSymW *dsym, QMutex *dsymLock, const QString &crashlogPath, const QString &dsymPath, SymbolicatedData &data, const std::function<void (unsigned int)> &progress)
 {
-    QString content = buildHeader(ipsHeader, payload);
+    bool inlining = UserConfigs::Get()->GetData("SymbolicateInlining", false);
     QJsonArray binaryImages = payload["usedImages"].toArray();
+    std::wstring uuid = GetIpsMainUUID(payload).toStdWString();
 
-    if (payload["threads"].isArray())
+    CMachOW* crashed_macho = NULL;
+    try {
+        QMutexLocker locker(dsymLock);
+        crashed_macho = dsym->GetMachO(uuid);
+    } catch (const char* messages) {
+        data.rawString = QString("Crashlog invalid! (%1)\n"
+                                 "Please check your crashlog and dsym or try to symbolicate or debug it in xcode...\n"
+                                 "\nLast crashlog: %2\n"
+                                 "\nLast dsym: %3\n").arg(messages).arg(crashlogPath).arg(dsymPath);
+        return false;
+    }
+
+    int appIndex = -1;
+    for (int idx = 0; idx < binaryImages.count(); idx++)
     {
-        QJsonArray threads = payload["threads"].toArray();
-        foreach (auto _thread, threads)
+        if (binaryImages[idx]["uuid"].toString("").remove('-') == QString::fromStdWString(uuid))
         {
-            content.append("\n");
-            QJsonObject thread = _thread.toObject();
+            appIndex = idx;
+            break;
+        }
+    }
 
-            if (thread["name"].isString() || thread["queue"].isString())
-            {
-                QString name = thread["name"].isString() ? thread["name"].toString("") : thread["queue"].toString("");
-                content.append(QString("Thread %1 name:  %2\n").arg(thread["id"].toInt()).arg(name));
-            }
+    auto symbolicateFrame = [&](const QJsonObject& frame, const QJsonObject& binaryImage, bool isApp) {
+        quint64 offset = frame["imageOffset"].toInteger();
+        if (isApp)
+            return GetAppSymbol(uuid, dsym, dsymLock, crashed_macho, offset, inlining);
 
-            if (thread["triggered"].isBool() && thread["triggered"].toBool() == false)
-                content.append(QString("Thread %1 Crashed:\n").arg(thread["id"].toInt()));
-            else
-                content.append(QString("Thread %1:\n").arg(thread["id"].toInt()));
-            content.append(buildFrameStack(thread["frames"].toArray(), binaryImages));
+        QString symbol;
+        if (frame["symbol"].isString())
+            symbol = QString("%1 + %2").arg(frame["symbol"].toString("")).arg(frame["symbolLocation"].toInteger());
+        else
+            symbol = GetSystemSymbol(binaryImage["uuid"].toString("").remove('-').toStdWString(), offset);
+
+        if (symbol.isEmpty())
+            symbol = QString("0x%1 + %2").arg(binaryImage["base"].toInteger(), 8, 16, QLatin1Char( '0' )).arg(offset);
+        if (frame["sourceFile"].isString() && frame["sourceLine"].isDouble())
+            symbol.append(QString(" (%1:%2)").arg(frame["sourceFile"].toString("")).arg(frame["sourceLine"].toInt()));
+        return symbol;
+    };
+
+    QString out = QString::fromUtf8(ipsHeader.toJson(QJsonDocument::Compact)) + "\n";
+    out.append(buildHeader(ipsHeader, payload));
+    if (payload["lastExceptionBacktrace"].isArray())
+    {
+        StackTrace stacktrace;
+        stacktrace.threadName = "Last Exception Backtrace";
+        out.append("Last Exception Backtrace:\n");
+        out.append(buildFrameStack(payload["lastExceptionBacktrace"].toArray(), binaryImages, appIndex, stacktrace, symbolicateFrame));
+        data.stackTraces.append(stacktrace);
+    }
+
+    QJsonArray threads = payload["threads"].toArray();
+    unsigned int lastProgress = 0;
+    for (int idx = 0; idx < threads.count(); idx++)
+    {
+        QJsonObject thread = threads[idx].toObject();
+        StackTrace stacktrace;
+        stacktrace.threadName = QString("Thread %1").arg(idx);
+        out.append("\n");
+
+        if (thread["name"].isString() || thread["queue"].isString())
+        {
+            QString name = thread["name"].isString() ? thread["name"].toString("") : thread["queue"].toString("");
+            stacktrace.threadName = QString("Thread %1 name:  %2").arg(idx).arg(name);
+            out.append(stacktrace.threadName + "\n");
+        }
+
+        stacktrace.crashed = thread["triggered"].toBool(false);
+        if (stacktrace.crashed)
+            out.append(QString("Thread %1 Crashed:\n").arg(idx));
+        else
+            out.append(QString("Thread %1:\n").arg(idx));
+        out.append(buildFrameStack(thread["frames"].toArray(), binaryImages, appIndex, stacktrace, symbolicateFrame));
+        data.stackTraces.append(stacktrace);
+
+        unsigned int percentage = (unsigned int)(((idx + 1) * 100) / threads.count());
+        if (progress && percentage != lastProgress && percentage < 100)
+        {
+            lastProgress = percentage;
+            progress(percentage);
         }
     }
-    content.append(buildBinaryImages(binaryImages));
-    return content;
+    out.append(buildBinaryImages(binaryImages));
+    data.rawString = out;
+    return true;
 }
 
 QString CrashSymbolicator::buildHeader(const QJsonDocument &ipsHeader, const QJsonDocument &payload)
@@ -369,15 +737,16 @@ QString CrashSymbolicator::buildHeader(const QJsonDocument &ipsHeader, const QJs
     return content;
 }
 
-QString CrashSymbolicator::buildFrameStack(const QJsonArray &frames, const QJsonArray &binaryImages)
+QString CrashSymbolicator::buildFrameStack(const QJsonArray &frames, const QJsonArray &binaryImages, int appIndex, StackTrace &stacktrace, const std::function<QString (const QJsonObject &, const QJsonObject &, bool)> &symbolicate)
 {
     QString content = "";
     int idx = 0;
     foreach (auto _frame, frames)
     {
         QJsonObject frame = _frame.toObject();
-        QJsonObject binaryImage = binaryImages[frame["imageIndex"].toInt()].toObject();
-        int address = frame["imageOffset"].toInt() + binaryImage["base"].toInt();
+        int imageIndex = frame["imageIndex"].toInt();
+        QJsonObject binaryImage = binaryImages[imageIndex].toObject();
+        quint64 address = frame["imageOffset"].toInteger() + binaryImage["base"].toInteger();
         content.append(QString("%1").arg(idx, -5));
         content.append(QString("%1").arg(binaryImage["name"].toString(""), -30));
         content.append("\t");
@@ -385,22 +754,23 @@ QString CrashSymbolicator::buildFrameStack(const QJsonArray &frames, const QJson
         QString hexvalue = QString("%1").arg(address, 8, 16, QLatin1Char( '0' ));
         content.append(QString("0x%1 ").arg(hexvalue));
 
-        if (frame["symbol"].isString() && frame["symbolLocation"].isDouble())
+        QString symbol = symbolicate(frame, binaryImage, imageIndex == appIndex);
+        content.append(symbol);
+        content.append("\n");
+
+        StackLine stackline;
+        stackline.binary = binaryImage["name"].toString("");
+        QString symbol_line = kSOURCE_LINE_REGEX.match(symbol).captured(0);
+        if (symbol_line.isEmpty())
         {
-            content.append(QString("%1 + %2").arg(frame["symbol"].toString("")).arg(frame["symbolLocation"].toInt()));
+            stackline.function = symbol;
         }
         else
         {
-            int64_t base = binaryImage["base"].toInteger();
-            QString hexbase = QString("%1").arg(base, 8, 16, QLatin1Char( '0' ));
-            content.append(QString("0x%1 + %2").arg(hexbase).arg(frame["imageOffset"].toInt()));
+            stackline.function = QString(symbol).remove(symbol_line).trimmed();
+            stackline.line = symbol_line.remove("(").remove(")");
         }
-
-        if (frame["sourceFile"].isString() && frame["sourceLine"].isDouble())
-        {
-            content.append(QString(" (%1:%2)").arg(frame["sourceFile"].toString("")).arg(frame["sourceLine"].toInt()));
-        }
-        content.append("\n");
+        stacktrace.lines.append(stackline);
         idx++;
     }
     return content;
@@ -461,19 +831,79 @@ bool CrashSymbolicator::IsUnsymbolicatedLine(QString line)
             && first_idx > tab_idx);
 }
 
-CSymbolsPackW *CrashSymbolicator::GetSystemSymbols()
+QString CrashSymbolicator::GetAppSymbol(const std::wstring &uuid, CMachODSymW *dsym, QMutex *dsymLock, CMachOW *macho, uint64_t address, bool inlining)
 {
-    CSymbolsPackW* opack = nullptr;
-    static const wchar_t kSYSTEM_SYMBOLS_FOLDER[] = L"SystemSymbols";
-    std::wstring file(kSYSTEM_SYMBOLS_FOLDER);
-    file.append(L"\\package.symbols");
-    if(io::CDirectory::IsExistDir(kSYSTEM_SYMBOLS_FOLDER))
+    if (inlining)
+    {
+        return m_symbolCache.Resolve(QString::fromStdWString(uuid) + ":inline", address, [macho, dsymLock, &uuid](quint64 addr){
+            return InliningCache::Get()->Resolve(QString::fromStdWString(uuid), addr, [macho, dsymLock](quint64 offset){
+                QMutexLocker locker(dsymLock);
+                return QString::fromStdWString(macho->GetInliningInfo(offset));
+            });
+        });
+    }
+    return m_symbolCache.Resolve(QString::fromStdWString(uuid), address, [dsym, dsymLock, &uuid](quint64 addr){
+        QMutexLocker locker(dsymLock);
+        return QString::fromStdWString(dsym->GetSymbolNameAt(uuid, addr));
+    });
+}
+
+QString CrashSymbolicator::GetSystemSymbol(const std::map<std::wstring, std::wstring> &linkNames, const QString &binary, uint64_t address, QString &binary_out)
+{
+    if (GetSystemSymbols() == nullptr)
+        return "";
+
+    auto resolve = [this, address](const std::wstring& uuid){
+        return GetSystemSymbol(uuid, address);
+    };
+
+    // frame already names its image, only that image can own the address
+    auto image = linkNames.find(binary.toStdWString());
+    if (image != linkNames.end())
+        return resolve(image->second);
+
+    QString systemSymbol;
+    for (const auto& linkname : linkNames)
     {
-        if(io::CDirectory::IsExistFile(file))
+        QString found = resolve(linkname.second);
+        if (!found.isEmpty())
         {
-            SymbolPackage::Ptr pack(new SymbolPackage(io::source_of_stream(file.c_str(), io::EENCODING_LITTLE_ENDIAN)));
-            opack = new CSymbolsPackW(pack);
+            systemSymbol = found;
+            binary_out = QString::fromStdWString(linkname.first);
         }
     }
-    return opack;
+    return systemSymbol;
+}
+
+QString CrashSymbolicator::GetSystemSymbol(const std::wstring &uuid, uint64_t address)
+{
+    CSymbolsPackW* symbols = GetSystemSymbols();
+    if (symbols == nullptr)
+        return "";
+
+    return m_symbolCache.Resolve(QString::fromStdWString(uuid), address, [symbols, &uuid](quint64 addr){
+        QMutexLocker locker(&m_systemSymbolsMutex);
+        return QString::fromStdWString(symbols->GetSymbolNameAt(uuid, addr));
+    });
+}
+
+CSymbolsPackW *CrashSymbolicator::GetSystemSymbols()
+{
+    // package is immutable once loaded, keep one copy for every symbolication
+    static std::once_flag loaded;
+    static std::unique_ptr<CSymbolsPackW> opack;
+    std::call_once(loaded, [](){
+        static const wchar_t kSYSTEM_SYMBOLS_FOLDER[] = L"SystemSymbols";
+        std::wstring file(kSYSTEM_SYMBOLS_FOLDER);
+        file.append(L"\\package.symbols");
+        if(io::CDirectory::IsExistDir(kSYSTEM_SYMBOLS_FOLDER))
+        {
+            if(io::CDirectory::IsExistFile(file))
+            {
+                SymbolPackage::Ptr pack(new SymbolPackage(io::source_of_stream(file.c_str(), io::EENCODING_LITTLE_ENDIAN)));
+                opack.reset(new CSymbolsPackW(pack));
+            }
+        }
+    });
+    return opack.get();
 }
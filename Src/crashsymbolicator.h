@@ -5,12 +5,16 @@
 #include "CMachOCrashLogW.h"
 #include "CMachODSymW.h"
 #include "CSymbolsPackW.h"
+#include "symbolcache.h"
+#include "asyncmanager.h"
 #include <QString>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QObject>
 #include <QThread>
+#include <QMutex>
+#include <memory>
 
 using namespace MachO;
 
@@ -25,6 +29,7 @@ struct StackTrace
 {
     QString threadName;
     QList<StackLine> lines;
+    bool crashed = false;
 };
 
 struct SymbolicatedData
@@ -40,8 +45,9 @@ public:
     static CrashSymbolicator *Get();
     static void Destroy();
     CrashSymbolicator();
+    ~CrashSymbolicator();
     void Process(QString crashlogPath, QString dsymDir);
-    QString ConvertToOldStyle(QString crashlogPath);
+    void ProcessBatch(QString crashlogDir, QStringList dsymPaths);
 
 protected:
     void onFind(CMachOCrashLog& crashlog) override;
@@ -50,13 +56,24 @@ protected:
     void onFind(CMachODyLib& dylib) override;
 
 private:
+    struct BatchDsym;
+    struct BatchState;
+    bool Symbolicate(CMachOCrashLogW* crashlog, CMachODSymW* dsym, QMutex* dsymLock, const QString& crashlogPath, const QString& dsymPath, SymbolicatedData& data, const std::function<void(unsigned int)>& progress = nullptr);
+    QJsonObject SymbolicateBatchItem(std::shared_ptr<BatchState> state, QString crashlogPath, QString output);
+    std::shared_ptr<BatchDsym> LoadIndexedDsym(std::shared_ptr<BatchState> state, QString uuid);
+    void FinishBatch(std::shared_ptr<BatchState> state);
     bool IsExceptionBacktrace(QString line);
     bool IsUnsymbolicatedLine(QString line);
-    CSymbolsPackW* GetSystemSymbols();
+    static CSymbolsPackW* GetSystemSymbols();
+    QString GetAppSymbol(const std::wstring& uuid, CMachODSymW* dsym, QMutex* dsymLock, CMachOW* macho, uint64_t address, bool inlining);
+    QString GetSystemSymbol(const std::map<std::wstring, std::wstring>& linkNames, const QString& binary, uint64_t address, QString& binary_out);
+    QString GetSystemSymbol(const std::wstring& uuid, uint64_t address);
 
-    QString ConvertToOldStyle(const QJsonDocument& ipsHeader, const QJsonDocument& payload);
+    static bool ReadIps(QString crashlogPath, QJsonDocument& ipsHeader, QJsonDocument& payload);
+    static QString GetIpsMainUUID(const QJsonDocument& payload);
+    bool SymbolicateIps(const QJsonDocument& ipsHeader, const QJsonDocument& payload, CMachODSymW* dsym, QMutex* dsymLock, const QString& crashlogPath, const QString& dsymPath, SymbolicatedData& data, const std::function<void(unsigned int)>& progress = nullptr);
     QString buildHeader(const QJsonDocument& ipsHeader, const QJsonDocument& payload);
-    QString buildFrameStack(const QJsonArray& frames, const QJsonArray& binaryImages);
+    QString buildFrameStack(const QJsonArray& frames, const QJsonArray& binaryImages, int appIndex, StackTrace& stacktrace, const std::function<QString(const QJsonObject&, const QJsonObject&, bool)>& symbolicate);
     QString buildBinaryImages(const QJsonArray& binaryImages);
 
     static CrashSymbolicator *m_instance;
@@ -64,12 +81,17 @@ private:
     CMachODSymW* m_dsym;
     QThread *m_thread;
     QString m_crashlogPath, m_dsymPath;
+    SymbolCache m_symbolCache;
+    AsyncManager *m_batchPool;
+    static QMutex m_systemSymbolsMutex;
 
 private slots:
     void doWork();
 
 signals:
     void SymbolicateResult2(unsigned int progress, SymbolicatedData data, bool error = false);
+    void BatchProgress(int done, int total, QString message);
+    void BatchFinished(QString indexPath, int succeeded, int failed);
 };
 
 #endif // CRASHSYMBOLICATOR_H
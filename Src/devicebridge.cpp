@@ -1,10 +1,13 @@
 #include "devicebridge.h"
 #include "extended_plist.h"
+#include "utils.h"
+#include "userconfigs.h"
 #include <QDebug>
 #include <QMessageBox>
 #include <QFileInfo>
 #include <QDir>
 #include <QSaveFile>
+#include <QFile>
 
 bool DeviceBridge::m_destroyed = false;
 DeviceBridge *DeviceBridge::m_instance = nullptr;
@@ -23,19 +26,16 @@ void DeviceBridge::Destroy()
 }
 
 DeviceBridge::DeviceBridge()
-    : m_device(nullptr)
-    , m_client(nullptr)
-    , m_diagnostics(nullptr)
-    , m_imageMounter(nullptr)
-    , m_screenshot(nullptr)
-    , m_afc(nullptr)
-    , m_crashlog(nullptr)
-    , m_installer(nullptr)
-    , m_syslog(nullptr)
+    : m_idleTimer(new QTimer(this))
+    , m_installPool(nullptr)
     , m_logHandler(new LogFilterThread())
     , m_debugger(nullptr)
     , m_debugHandler(new DebuggerFilterThread())
+    , m_transport(nullptr)
+    , m_connection(nullptr)
 {
+    connect(m_idleTimer, &QTimer::timeout, this, &DeviceBridge::FreeIdleServices);
+    m_idleTimer->start(SERVICE_IDLE_TIMEOUT_MS / 4);
     connect(m_logHandler, SIGNAL(FilterComplete(QString)), this, SIGNAL(SystemLogsReceived2(QString)));
     connect(m_logHandler, SIGNAL(FilterStatusChanged(bool)), this, SIGNAL(FilterStatusChanged(bool)));
     connect(m_debugHandler, SIGNAL(FilterComplete(QString)), this, SIGNAL(DebuggerReceived(QString)));
@@ -46,6 +46,8 @@ DeviceBridge::~DeviceBridge()
 {
     idevice_event_unsubscribe();
     ResetConnection();
+    if (m_installPool)
+        delete m_installPool;
     delete m_logHandler;
 }
 
@@ -53,6 +55,7 @@ void DeviceBridge::Init(QWidget *parent)
 {
     idevice_set_debug_level(1);
     idevice_event_subscribe(DeviceEventCallback, nullptr);
+    PerfStore::RemoveStaleSpills();
 }
 
 QMap<QString, idevice_connection_type> DeviceBridge::GetDevices()
@@ -61,287 +64,224 @@ QMap<QString, idevice_connection_type> DeviceBridge::GetDevices()
     int dev_count = 0;
     idevice_get_device_list_extended(&dev_list, &dev_count);
 
-    m_deviceList.clear();
+    QMap<QString, idevice_connection_type> devices;
     for (int idx = 0; idx < dev_count; idx++)
     {
-        m_deviceList[dev_list[idx]->udid] = dev_list[idx]->conn_type;
+        devices[dev_list[idx]->udid] = dev_list[idx]->conn_type;
     }
     if (dev_list)
         idevice_device_list_extended_free(dev_list);
+
+    QMutexLocker locker(&m_deviceListMutex);
+    m_deviceList = devices;
+    return devices;
+}
+
+QMap<QString, idevice_connection_type> DeviceBridge::AttachedDevices()
+{
+    QMutexLocker locker(&m_deviceListMutex);
     return m_deviceList;
 }
 
 void DeviceBridge::ResetConnection()
 {
-    bool is_exist = m_deviceList.find(m_currentUdid) != m_deviceList.end();
-    m_currentUdid.clear();
     StopDebugging();
-
-    if(m_client)
-    {
-        //Quick fix: stuck while reseting connection at exit, switch, reconnect
-        //is_exist ? (void)lockdownd_client_free(m_client) : free(m_client);
-        m_client = nullptr;
-    }
-
-    if (m_screenshot)
+    QMap<QString, std::shared_ptr<DeviceSession>> sessions;
     {
-        screenshotr_client_free(m_screenshot);
-        m_screenshot = nullptr;
+        QMutexLocker locker(&m_sessionsMutex);
+        sessions.swap(m_sessions);
+        m_currentUdid.clear();
     }
 
-    if (m_imageMounter)
-    {
-        if (is_exist)
-            mobile_image_mounter_hangup(m_imageMounter);
-        mobile_image_mounter_free(m_imageMounter);
-        m_imageMounter = nullptr;
-    }
-
-    if (m_afc)
-    {
-        afc_client_free(m_afc);
-        m_afc = nullptr;
-    }
-
-    if (m_crashlog)
-    {
-        afc_client_free(m_crashlog);
-        m_crashlog = nullptr;
-    }
+    QMap<QString, idevice_connection_type> devices = AttachedDevices();
+    foreach (const auto& session, sessions)
+        session->Close(devices.contains(session->GetUdid()));
+}
 
-    if (m_installer)
-    {
-        instproxy_client_free(m_installer);
-        m_installer = nullptr;
-    }
+void DeviceBridge::DisconnectDevice(QString udid)
+{
+    if (GetCurrentUdid() == udid)
+        StopDebugging();
 
-    if (m_syslog)
+    std::shared_ptr<DeviceSession> session;
     {
-        syslog_relay_client_free(m_syslog);
-        m_syslog = nullptr;
+        QMutexLocker locker(&m_sessionsMutex);
+        session = m_sessions.take(udid);
+        if (m_currentUdid == udid)
+            m_currentUdid.clear();
     }
 
-    if(m_device)
-    {
-        //Quick fix: crash when try to connect unpaired device
-        //idevice_free(m_device);
-        m_device = nullptr;
-    }
+    if (session)
+        session->Close(AttachedDevices().contains(udid));
 }
 
 void DeviceBridge::ConnectToDevice(QString udid)
 {
     AsyncManager::Get()->StartAsyncRequest([this, udid]() {
-        emit ProcessStatusChanged(0, "Reset previous connection...");
-        ResetConnection();
-
-        //connect to udid
-        emit ProcessStatusChanged(10, "Connecting to " + udid + "...");
-        idevice_new_with_options(&m_device, udid.toStdString().c_str(), m_deviceList[udid] == CONNECTION_USBMUXD ? IDEVICE_LOOKUP_USBMUX : IDEVICE_LOOKUP_NETWORK);
-        if (!m_device) {
-            emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: No device with UDID " + udid);
-            return;
+        QElapsedTimer total;
+        total.start();
+
+        // a second click while the first connect is still running must not open another session
+        {
+            QMutexLocker locker(&m_sessionsMutex);
+            if (m_connecting.contains(udid))
+                return;
+            m_connecting.insert(udid);
         }
+        std::shared_ptr<void> pending(this, [udid](void* ptr) {
+            DeviceBridge* bridge = (DeviceBridge*)ptr;
+            QMutexLocker locker(&bridge->m_sessionsMutex);
+            bridge->m_connecting.remove(udid);
+        });
 
-        emit ProcessStatusChanged(15, "Handshaking client...");
-        if (LOCKDOWN_E_SUCCESS != lockdownd_client_new_with_handshake(m_device, &m_client, TOOL_NAME)) {
-            idevice_free(m_device);
-            emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Connecting to " + udid + " failed!");
-            return;
+        // the debugger and the syslog view follow the current device only
+        if (GetCurrentUdid() != udid)
+            StopDebugging();
+
+        std::shared_ptr<DeviceSession> session = GetSession(udid);
+        QStringList timings;
+        if (session && !session->IsAlive())
+        {
+            // the warm session went stale, e.g. the device rebooted or re-enumerated
+            DisconnectDevice(udid);
+            session.reset();
         }
+        if (session)
+        {
+            timings << "warm session";
+        }
+        else
+        {
+            emit ProcessStatusChanged(10, "Connecting to " + udid + "...");
+            session = std::make_shared<DeviceSession>(udid, AttachedDevices().value(udid, CONNECTION_USBMUXD), [this](const QString& message) {
+                emit MessagesReceived(MessagesType::MSG_ERROR, message);
+            });
+            if (!session->Connect(timings))
+                return;
+
+            QMutexLocker locker(&m_sessionsMutex);
+            m_sessions[udid] = session;
+        }
+
+        emit ProcessStatusChanged(50, "Starting syslog relay service...");
+        SetCurrentSession(session);
+        emit DeviceConnected();
+
+        // the cached list is enough for the pid filter, the browse opens the installer in the background
+        LoadInstalledApps(session);
+        GetInstalledApps(true);
 
-        emit ProcessStatusChanged(20, "Getting device info...");
-        m_currentUdid = udid;
-        UpdateDeviceInfo();
-        emit ProcessStatusChanged(100, "Connected to " + GetDeviceInfo()["DeviceName"].toString() + "!");
+        timings << QString("total %1 ms").arg(total.elapsed());
+        qDebug() << "connect timings:" << udid << timings.join(", ");
+        emit ProcessStatusChanged(100, "Connected to " + session->GetDeviceInfo()["DeviceName"].toString() + "! (" + timings.join(", ") + ")");
     });
 }
 
-QString DeviceBridge::GetCurrentUdid()
+void DeviceBridge::SetCurrentSession(std::shared_ptr<DeviceSession> session)
 {
-    return m_currentUdid;
+    std::shared_ptr<DeviceSession> previous;
+    {
+        QMutexLocker locker(&m_sessionsMutex);
+        previous = m_sessions.value(m_currentUdid);
+        m_currentUdid = session->GetUdid();
+    }
+
+    // one capture at a time, the log view shows a single device
+    if (previous && previous != session)
+        previous->SetActive(false);
+    session->SetActive(true);
+    session->StartSyslog(SystemLogsCallback);
 }
 
-bool DeviceBridge::IsConnected()
+std::shared_ptr<DeviceSession> DeviceBridge::GetSession(QString udid)
 {
-    return !m_currentUdid.isEmpty();
+    QMutexLocker locker(&m_sessionsMutex);
+    return m_sessions.value(udid.isEmpty() ? m_currentUdid : udid);
 }
 
-void DeviceBridge::UpdateDeviceInfo()
+QStringList DeviceBridge::GetConnectedDevices()
 {
-    plist_t node = nullptr;
-    if(lockdownd_get_value(m_client, nullptr, nullptr, &node) == LOCKDOWN_E_SUCCESS) {
-        if (node) {
-            QJsonDocument deviceInfo = PlistToJson(node);
-            m_deviceInfo[m_currentUdid] = deviceInfo;
-            plist_free(node);
-            node = nullptr;
-            emit DeviceConnected();
-
-            //start services
-            StartServices();
-        }
-    }
+    QMutexLocker locker(&m_sessionsMutex);
+    return m_sessions.keys();
 }
 
-QJsonDocument DeviceBridge::GetDeviceInfo(QString udid)
+QString DeviceBridge::GetCurrentUdid()
 {
-    return m_deviceInfo[udid.isEmpty() ? m_currentUdid : udid];
+    QMutexLocker locker(&m_sessionsMutex);
+    return m_currentUdid;
 }
 
-void DeviceBridge::StartServices()
+bool DeviceBridge::IsConnected()
 {
-    emit ProcessStatusChanged(30, "Starting installation proxy service...");
-    QStringList serviceIds = QStringList() << "com.apple.mobile.installation_proxy";
-    StartLockdown(!m_installer, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
-        instproxy_error_t err = instproxy_client_new(m_device, service, &m_installer);
-        if (err != INSTPROXY_E_SUCCESS)
-            emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
-    });
-
-    emit ProcessStatusChanged(35, "Getting installed apps info...");
-    m_installedApps = GetInstalledApps(false);
-
-    emit ProcessStatusChanged(40, "Starting crash report mover service...");
-    serviceIds = QStringList() << "com.apple.crashreportmover";
-    StartLockdown(!m_crashlog, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
-        service_client_t svcmove = NULL;
-        service_error_t err = service_client_new(m_device, service, &svcmove);
-        if (err != SERVICE_E_SUCCESS)
-        {
-            emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
-            return;
-        }
-
-        /* read "ping" message which indicates the crash logs have been moved to a safe harbor */
-        char* ping = (char*)malloc(4);
-        memset(ping, '\0', 4);
-        int attempts = 0;
-        while ((strncmp(ping, "ping", 4) != 0) && (attempts < 10)) {
-            uint32_t bytes = 0;
-            err = service_receive_with_timeout(svcmove, ping, 4, &bytes, 2000);
-            if (err == SERVICE_E_SUCCESS || err == SERVICE_E_TIMEOUT) {
-                attempts++;
-                continue;
-            }
-
-            fprintf(stderr, "ERROR: Crash logs could not be moved. Connection interrupted (%d).\n", err);
-            break;
-        }
-        service_client_free(svcmove);
-        free(ping);
-
-        if (attempts >= 10) {
-            fprintf(stderr, "ERROR: Failed to receive ping message from crash report mover.\n");
-        }
-    });
-
-    emit ProcessStatusChanged(50, "Starting crash report copy service...");
-    serviceIds = QStringList() << "com.apple.crashreportcopymobile";
-    StartLockdown(!m_crashlog, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
-        afc_error_t err = afc_client_new(m_device, service, &m_crashlog);
-        if (err != AFC_E_SUCCESS)
-            emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
-    });
-
-    emit ProcessStatusChanged(60, "Starting afc service...");
-    serviceIds = QStringList() << "com.apple.afc";
-    StartLockdown(!m_afc, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
-        afc_error_t err = afc_client_new(m_device, service, &m_afc);
-        if (err != AFC_E_SUCCESS)
-            emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
-    });
-
-    emit ProcessStatusChanged(70, "Starting image mounter service...");
-    serviceIds = QStringList() << MOBILE_IMAGE_MOUNTER_SERVICE_NAME;
-    StartLockdown(!m_imageMounter, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
-        mobile_image_mounter_error_t err = mobile_image_mounter_new(m_device, service, &m_imageMounter);
-        if (err != MOBILE_IMAGE_MOUNTER_E_SUCCESS)
-            emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
-    });
-
-    emit ProcessStatusChanged(80, "Starting syslog relay service...");
-    serviceIds = QStringList() << SYSLOG_RELAY_SERVICE_NAME;
-    StartLockdown(!m_syslog, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
-        /* connect to syslog_relay service */
-        syslog_relay_error_t err = SYSLOG_RELAY_E_UNKNOWN_ERROR;
-        err = syslog_relay_client_new(m_device, service, &m_syslog);
-        if (err != SYSLOG_RELAY_E_SUCCESS) {
-            emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
-            return;
-        }
-
-        /* start capturing syslog */
-        err = syslog_relay_start_capture_raw(m_syslog, SystemLogsCallback, nullptr);
-        if (err != SYSLOG_RELAY_E_SUCCESS) {
-            emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Unable to start capturing syslog.");
-            syslog_relay_client_free(m_syslog);
-            m_syslog = nullptr;
-            return;
-        }
-    });
+    return !GetCurrentUdid().isEmpty();
 }
 
-void DeviceBridge::StartLockdown(bool condition, QStringList service_ids, const std::function<void (QString&, lockdownd_service_descriptor_t&)> &function)
+PlistView DeviceBridge::GetDeviceInfo(QString udid)
 {
-    if (!condition)
-        return;
+    auto session = GetSession(udid);
+    return session ? session->GetDeviceInfo() : PlistView();
+}
 
-    lockdownd_error_t lerr = lockdownd_error_t::LOCKDOWN_E_UNKNOWN_ERROR;
-    lockdownd_service_descriptor_t service = nullptr;
-    QString service_id;
-    for ( const auto& svc_id : service_ids)
+void DeviceBridge::FreeIdleServices()
+{
+    QList<std::shared_ptr<DeviceSession>> sessions;
     {
-        service_id = svc_id;
-        lerr = lockdownd_start_service(m_client, svc_id.toUtf8().data(), &service);
-        if(lerr == LOCKDOWN_E_SUCCESS) { break; }
+        QMutexLocker locker(&m_sessionsMutex);
+        sessions = m_sessions.values();
     }
 
-    switch (lerr)
+    // devices switched away from stay connected for WarmConnectionSeconds, 0 disconnects on switch
+    qint64 warm_msecs = qint64(UserConfigs::Get()->GetData("WarmConnectionSeconds", 300)) * 1000;
+    QString current = GetCurrentUdid();
+    foreach (const auto& session, sessions)
     {
-        case LOCKDOWN_E_SUCCESS:
-            function(service_id, service);
-            lockdownd_service_descriptor_free(service);
-            break;
-
-        case LOCKDOWN_E_PASSWORD_PROTECTED:
-            emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Device is passcode protected, enter passcode on the device to continue.");
-            break;
-
-        default:
-            emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Could not connect to " + service_id + " lockdownd: " + QString::number(lerr));
-            break;
+        if (session->GetUdid() != current && session->InactiveMsecs() >= warm_msecs)
+        {
+            // a warm session still running bulk work is kept until its holders are done, the next tick retries
+            if (session->CloseIfIdle())
+            {
+                QMutexLocker locker(&m_sessionsMutex);
+                if (m_sessions.value(session->GetUdid()) == session)
+                    m_sessions.remove(session->GetUdid());
+            }
+            continue;
+        }
+        session->FreeIdleServices();
     }
 }
 
 void DeviceBridge::StartDiagnostics(DiagnosticsMode mode)
 {
+    auto session = GetSession();
+    if (!session)
+        return;
+
+    diagnostics_relay_client_t diagnostics = nullptr;
     QStringList serviceIds = QStringList() << "com.apple.mobile.diagnostics_relay" << "com.apple.iosdiagnostics.relay";
-    StartLockdown(!m_diagnostics, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
-        diagnostics_relay_error_t err = diagnostics_relay_client_new(m_device, service, &m_diagnostics);
+    session->StartLockdown(true, serviceIds, [this, session, &diagnostics](QString& service_id, lockdownd_service_descriptor_t& service){
+        diagnostics_relay_error_t err = diagnostics_relay_client_new(session->Device(), service, &diagnostics);
         if (err != DIAGNOSTICS_RELAY_E_SUCCESS)
             emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
     });
 
-    if (m_diagnostics)
+    if (diagnostics)
     {
         switch (mode)
         {
         case CMD_SLEEP:
-            if (diagnostics_relay_sleep(m_diagnostics) == DIAGNOSTICS_RELAY_E_SUCCESS)
+            if (diagnostics_relay_sleep(diagnostics) == DIAGNOSTICS_RELAY_E_SUCCESS)
                 emit MessagesReceived(MessagesType::MSG_INFO, "Putting device into deep sleep mode.");
             else
                 emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Failed to put device into deep sleep mode.");
             break;
         case CMD_RESTART:
-            if (diagnostics_relay_restart(m_diagnostics, DIAGNOSTICS_RELAY_ACTION_FLAG_WAIT_FOR_DISCONNECT) == DIAGNOSTICS_RELAY_E_SUCCESS)
+            if (diagnostics_relay_restart(diagnostics, DIAGNOSTICS_RELAY_ACTION_FLAG_WAIT_FOR_DISCONNECT) == DIAGNOSTICS_RELAY_E_SUCCESS)
                 emit MessagesReceived(MessagesType::MSG_INFO, "Restarting device.");
             else
                 emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Failed to restart device.");
             break;
         case CMD_SHUTDOWN:
-            if (diagnostics_relay_shutdown(m_diagnostics, DIAGNOSTICS_RELAY_ACTION_FLAG_WAIT_FOR_DISCONNECT) == DIAGNOSTICS_RELAY_E_SUCCESS)
+            if (diagnostics_relay_shutdown(diagnostics, DIAGNOSTICS_RELAY_ACTION_FLAG_WAIT_FOR_DISCONNECT) == DIAGNOSTICS_RELAY_E_SUCCESS)
                 emit MessagesReceived(MessagesType::MSG_INFO, "Shutting down device.");
             else
                 emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Failed to shutdown device.");
@@ -350,9 +290,8 @@ void DeviceBridge::StartDiagnostics(DiagnosticsMode mode)
             break;
         }
 
-        diagnostics_relay_goodbye(m_diagnostics);
-        diagnostics_relay_client_free(m_diagnostics);
-        m_diagnostics = nullptr;
+        diagnostics_relay_goodbye(diagnostics);
+        diagnostics_relay_client_free(diagnostics);
     }
     else
     {
@@ -363,16 +302,16 @@ void DeviceBridge::StartDiagnostics(DiagnosticsMode mode)
 QStringList DeviceBridge::GetMountedImages()
 {
     QStringList signatures;
-    if (!m_imageMounter)
+    auto session = GetSession();
+    auto mounter = session ? session->AcquireService(SERVICE_IMAGE_MOUNTER) : nullptr;
+    if (!mounter)
         return signatures;
 
-    QJsonDocument doc;
     plist_t result = nullptr;
-    mobile_image_mounter_error_t err = mobile_image_mounter_lookup_image(m_imageMounter, "Developer", &result);
+    mobile_image_mounter_error_t err = mobile_image_mounter_lookup_image(session->ImageMounter(), "Developer", &result);
     if (err == MOBILE_IMAGE_MOUNTER_E_SUCCESS)
     {
-        doc = PlistToJson(result);
-        auto arr = doc["ImageSignature"].toArray();
+        auto arr = PlistView(result)["ImageSignature"].toArray();
         for (int idx = 0; idx < arr.count(); idx++)
         {
             signatures.append(arr[idx].toString());
@@ -381,10 +320,9 @@ QStringList DeviceBridge::GetMountedImages()
     else
     {
         emit MessagesReceived(MessagesType::MSG_ERROR, "Error: lookup_image returned " + QString::number(err));
+        if (result)
+            plist_free(result);
     }
-
-    if (result)
-        plist_free(result);
     return signatures;
 }
 
@@ -394,9 +332,15 @@ bool DeviceBridge::IsImageMounted()
     return !mounted.empty();
 }
 
-void DeviceBridge::MountImage(QString image_path, QString signature_path)
+AsyncTask<bool> DeviceBridge::MountImage(QString image_path, QString signature_path)
 {
-    AsyncManager::Get()->StartAsyncRequest([this, image_path, signature_path]() {
+    auto session = GetSession();
+    return AsyncManager::Get()->Run([this, session, image_path, signature_path](const CancellationToken& token) {
+        auto mounter = session ? session->AcquireService(SERVICE_IMAGE_MOUNTER) : nullptr;
+        if (!mounter) {
+            emit MounterStatusChanged("Error: Could not connect to image mounter service!");
+            return false;
+        }
         char sig[8192];
         size_t sig_length = 0;
         size_t image_size = 0;
@@ -406,37 +350,37 @@ void DeviceBridge::MountImage(QString image_path, QString signature_path)
         FILE *f = fopen(signature_path.toUtf8().data(), "rb");
         if (!f) {
             emit MounterStatusChanged("Error: opening signature file '" + signature_path + "' : " + strerror(errno));
-            return;
+            return false;
         }
         sig_length = fread(sig, 1, sizeof(sig), f);
         fclose(f);
         if (sig_length == 0) {
             emit MounterStatusChanged("Error: Could not read signature from file '" + signature_path + "'");
-            return;
+            return false;
         }
 
         f = fopen(image_path.toUtf8().data(), "rb");
         if (!f) {
             emit MounterStatusChanged("Error: opening image file '" + image_path + "' : " + strerror(errno));
-            return;
+            return false;
         }
 
         struct stat fst;
         if (stat(image_path.toUtf8().data(), &fst) != 0) {
             emit MounterStatusChanged("Error: stat: '" + image_path + "' : " + strerror(errno));
-            return;
+            return false;
         }
         image_size = fst.st_size;
         if (stat(signature_path.toUtf8().data(), &fst) != 0) {
             emit MounterStatusChanged("Error: stat: '" + signature_path + "' : " + strerror(errno));
-            return;
+            return false;
         }
 
         QString targetname = QString(PKG_PATH) + "/staging.dimage";
         QString mountname = QString(PATH_PREFIX) + "/" + targetname;
 
         MounterType mount_type = DISK_IMAGE_UPLOAD_TYPE_AFC;
-        QStringList os_version = m_deviceInfo[m_currentUdid]["ProductVersion"].toString().split(".");
+        QStringList os_version = session->GetDeviceInfo()["ProductVersion"].toString().split(".");
         if (os_version[0].toInt() >= 7) {
             mount_type = DISK_IMAGE_UPLOAD_TYPE_UPLOAD_IMAGE;
         }
@@ -444,22 +388,28 @@ void DeviceBridge::MountImage(QString image_path, QString signature_path)
         switch (mount_type) {
         case DISK_IMAGE_UPLOAD_TYPE_UPLOAD_IMAGE:
             emit MounterStatusChanged("Uploading '" + QFileInfo(image_path).fileName() + "' to device...");
-            err = mobile_image_mounter_upload_image(m_imageMounter, "Developer", image_size, sig, sig_length, ImageMounterCallback, f);
+            err = mobile_image_mounter_upload_image(session->ImageMounter(), "Developer", image_size, sig, sig_length, ImageMounterCallback, f);
             if (err != MOBILE_IMAGE_MOUNTER_E_SUCCESS) {
                 QString message("ERROR: Unknown error occurred, can't mount.");
                 if (err == MOBILE_IMAGE_MOUNTER_E_DEVICE_LOCKED) {
                     message = "ERROR: Device is locked, can't mount. Unlock device and try again.";
                 }
                 emit MounterStatusChanged("Error: " + message);
-                return;
+                return false;
             }
             break;
 
         default:
             emit MounterStatusChanged("Uploading " + QFileInfo(image_path).fileName() + " --> afc:///" + targetname);
+            auto afc = session->AcquireService(SERVICE_AFC);
+            if (!afc) {
+                fclose(f);
+                emit MounterStatusChanged("Error: Could not connect to afc service!");
+                return false;
+            }
             char **strs = NULL;
-            if (afc_get_file_info(m_afc, PKG_PATH, &strs) != AFC_E_SUCCESS) {
-                if (afc_make_directory(m_afc, PKG_PATH) != AFC_E_SUCCESS) {
+            if (afc_get_file_info(session->Afc(), PKG_PATH, &strs) != AFC_E_SUCCESS) {
+                if (afc_make_directory(session->Afc(), PKG_PATH) != AFC_E_SUCCESS) {
                     emit MounterStatusChanged("WARNING: Could not create directory '" + QString(PKG_PATH) + "' on device!\n");
                 }
             }
@@ -473,21 +423,27 @@ void DeviceBridge::MountImage(QString image_path, QString signature_path)
             }
 
             uint64_t af = 0;
-            if ((afc_file_open(m_afc, targetname.toUtf8().data(), AFC_FOPEN_WRONLY, &af) != AFC_E_SUCCESS) || !af) {
+            if ((afc_file_open(session->Afc(), targetname.toUtf8().data(), AFC_FOPEN_WRONLY, &af) != AFC_E_SUCCESS) || !af) {
                 fclose(f);
                 emit MounterStatusChanged("Error: afc_file_open on '" + targetname + "' failed!");
-                return;
+                return false;
             }
 
             char buf[8192];
             size_t amount = 0;
             do {
+                if (token.IsCancelled()) {
+                    emit MounterStatusChanged("Error: Device disconnected, upload cancelled!");
+                    afc_file_close(session->Afc(), af);
+                    fclose(f);
+                    return false;
+                }
                 amount = fread(buf, 1, sizeof(buf), f);
                 if (amount > 0) {
                     uint32_t written, total = 0;
                     while (total < amount) {
                         written = 0;
-                        if (afc_file_write(m_afc, af, buf + total, amount - total, &written) != AFC_E_SUCCESS) {
+                        if (afc_file_write(session->Afc(), af, buf + total, amount - total, &written) != AFC_E_SUCCESS) {
                             emit MounterStatusChanged("Error: AFC Write error!");
                             break;
                         }
@@ -495,26 +451,30 @@ void DeviceBridge::MountImage(QString image_path, QString signature_path)
                     }
                     if (total != amount) {
                         emit MounterStatusChanged("Error: wrote only " + QString::number(total) + " of " + QString::number(amount));
-                        afc_file_close(m_afc, af);
+                        afc_file_close(session->Afc(), af);
                         fclose(f);
-                        return;
+                        return false;
                     }
                 }
             }
             while (amount > 0);
 
-            afc_file_close(m_afc, af);
+            afc_file_close(session->Afc(), af);
             break;
         }
         fclose(f);
         emit MounterStatusChanged("Image uploaded.");
 
         emit MounterStatusChanged("Mounting...");
-        err = mobile_image_mounter_mount_image(m_imageMounter, mountname.toUtf8().data(), sig, sig_length, "Developer", &result);
+        err = mobile_image_mounter_mount_image(session->ImageMounter(), mountname.toUtf8().data(), sig, sig_length, "Developer", &result);
         if (err == MOBILE_IMAGE_MOUNTER_E_SUCCESS)
         {
             emit MounterStatusChanged("Developer disk image mounted");
-            ConnectToDevice(m_currentUdid); //hack to fix LOCKDOWN_E_MUX_ERROR after mounted
+            //hack to fix LOCKDOWN_E_MUX_ERROR after mounted
+            QString udid = session->GetUdid();
+            mounter.reset();
+            DisconnectDevice(udid);
+            ConnectToDevice(udid);
         }
         else
         {
@@ -526,22 +486,21 @@ void DeviceBridge::MountImage(QString image_path, QString signature_path)
             emit MounterStatusChanged(PlistToJson(result).toJson());
             plist_free(result);
         }
-    });
+        return err == MOBILE_IMAGE_MOUNTER_E_SUCCESS;
+    }, TASK_BULK, session ? session->Token() : CancellationToken());
 }
 
-void DeviceBridge::Screenshot(QString path)
+AsyncTask<bool> DeviceBridge::Screenshot(QString path)
 {
-    AsyncManager::Get()->StartAsyncRequest([this, path]() {
-        QStringList serviceIds = QStringList() << SCREENSHOTR_SERVICE_NAME;
-        StartLockdown(!m_screenshot, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
-            screenshotr_error_t err = screenshotr_client_new(m_device, service, &m_screenshot);
-            if (err != SCREENSHOTR_E_SUCCESS)
-                emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
-        });
+    auto session = GetSession();
+    return AsyncManager::Get()->Run([this, session, path](const CancellationToken& token) {
+        auto screenshot = session ? session->AcquireService(SERVICE_SCREENSHOT) : nullptr;
+        if (!screenshot || token.IsCancelled())
+            return false;
 
         char *imgdata = NULL;
         uint64_t imgsize = 0;
-        screenshotr_error_t error = screenshotr_take_screenshot(m_screenshot, &imgdata, &imgsize);
+        screenshotr_error_t error = screenshotr_take_screenshot(session->Screenshot(), &imgdata, &imgsize);
         if (error == SCREENSHOTR_E_SUCCESS)
         {
             QFileInfo file_info(path);
@@ -551,42 +510,71 @@ void DeviceBridge::Screenshot(QString path)
             file.write(imgdata, imgsize);
             file.commit();
             emit ScreenshotReceived(path);
+            return true;
         }
         else
         {
             emit MessagesReceived(MessagesType::MSG_ERROR, "Error: screenshotr_take_screenshot returned " + QString::number(error));
+            return false;
         }
-    });
+    }, TASK_INTERACTIVE, session ? session->Token() : CancellationToken());
 }
 
-void DeviceBridge::SyncCrashlogs(QString path)
+AsyncTask<bool> DeviceBridge::SyncCrashlogs(QString path)
 {
-    AsyncManager::Get()->StartAsyncRequest([this, path]() {
+    auto session = GetSession();
+    return AsyncManager::Get()->Run([this, session, path](const CancellationToken& token) {
+        auto crashlog = session ? session->AcquireService(SERVICE_CRASHLOG) : nullptr;
+        if (!crashlog) {
+            emit CrashlogsStatusChanged("Error: Could not connect to crash report copy service!");
+            return false;
+        }
         QDir().mkpath(path);
-        int result = afc_copy_crash_reports(m_crashlog, ".", path.toUtf8().data(), path.toUtf8().data());
+
+        // size and mtime of every report already pulled from this device
+        QString manifestPath = GetDirectory(DIRECTORY_TYPE::LOCALDATA) + "crashsync_" + session->GetUdid() + ".json";
+        QFile manifestFile(manifestPath);
+        QJsonObject manifest;
+        if (manifestFile.open(QIODevice::ReadOnly))
+        {
+            manifest = QJsonDocument::fromJson(manifestFile.readAll()).object();
+            manifestFile.close();
+        }
+
+        CrashlogSyncStats stats;
+        int result = afc_copy_crash_reports(session->Crashlog(), ".", path, manifest, stats, token);
+        if (token.IsCancelled())
+            emit CrashlogsStatusChanged("Device disconnected, crashlog sync cancelled!");
+
+        QSaveFile saveFile(manifestPath);
+        if (saveFile.open(QIODevice::WriteOnly))
+        {
+            saveFile.write(QJsonDocument(manifest).toJson(QJsonDocument::Compact));
+            saveFile.commit();
+        }
+        emit CrashlogsStatusChanged(QString("Copied %1 file(s) (%2), skipped %3 unchanged file(s) (%4)")
+                                    .arg(stats.copied).arg(BytesToString(stats.copiedBytes))
+                                    .arg(stats.skipped).arg(BytesToString(stats.skippedBytes)));
         emit CrashlogsStatusChanged(QString::asprintf("Done, error code: %d", result));
-    });
+        return result == 0;
+    }, TASK_BULK, session ? session->Token() : CancellationToken());
 }
 
 void DeviceBridge::TriggerUpdateDevices(idevice_event_type eventType, idevice_connection_type connectionType, QString udid)
 {
-    switch (eventType)
+    QMap<QString, idevice_connection_type> devices;
     {
-    case idevice_event_type::IDEVICE_DEVICE_ADD:
-        m_deviceList[udid] = connectionType;
-        break;
-
-    case idevice_event_type::IDEVICE_DEVICE_REMOVE:
-        m_deviceList.remove(udid);
-        if (m_currentUdid == udid)
-            ResetConnection();
-        break;
-
-    default:
-        break;
+        QMutexLocker locker(&m_deviceListMutex);
+        if (eventType == idevice_event_type::IDEVICE_DEVICE_ADD)
+            m_deviceList[udid] = connectionType;
+        else if (eventType == idevice_event_type::IDEVICE_DEVICE_REMOVE)
+            m_deviceList.remove(udid);
+        devices = m_deviceList;
     }
+    if (eventType == idevice_event_type::IDEVICE_DEVICE_REMOVE)
+        DisconnectDevice(udid);
 
-    emit UpdateDevices(m_deviceList);
+    emit UpdateDevices(devices);
 }
 
 void DeviceBridge::DeviceEventCallback(const idevice_event_t *event, void *userdata)
@@ -5,6 +5,10 @@
 #include <QString>
 #include <QJsonDocument>
 #include <QJsonArray>
+#include <QElapsedTimer>
+#include <QSet>
+#include <memory>
+#include <QTimer>
 #include <vector>
 #include <libimobiledevice/libimobiledevice.h>
 #include <libimobiledevice/lockdown.h>
@@ -21,6 +25,9 @@
 #include "logpacket.h"
 #include "logfilterthread.h"
 #include "asyncmanager.h"
+#include "devicesession.h"
+#include "perfmetrics.h"
+#include "perfstore.h"
 #include "qmutex.h"
 
 #include "idevice/instrument/dtxchannel.h"
@@ -35,6 +42,16 @@ using namespace idevice;
 #define PKG_PATH                        "PublicStaging"
 #define APPARCH_PATH                    "ApplicationArchives"
 #define PATH_PREFIX                     "/private/var/mobile/Media"
+#define APPS_REFRESH_INTERVAL_MS        10000
+#define AFC_POOL_SIZE                   4
+#define AFC_CHUNK_MIN                   (64 * 1024)
+#define AFC_CHUNK_USB                   (1024 * 1024)
+#define AFC_CHUNK_NETWORK               (2 * 1024 * 1024)
+#define AFC_CHUNK_MAX                   (8 * 1024 * 1024)
+#define AFC_CHUNK_FAST_MS               50
+#define AFC_CHUNK_SLOW_MS               400
+#define AFC_PROGRESS_INTERVAL_MS        100
+#define PERF_WINDOW_MS                  (5 * 60 * 1000)
 
 enum InstallerMode {
     CMD_INSTALL,
@@ -70,37 +87,42 @@ public:
     void ConnectToDevice(QString udid);
     QString GetCurrentUdid();
     bool IsConnected();
-    QJsonDocument GetDeviceInfo(QString udid = "");
+    PlistView GetDeviceInfo(QString udid = "");
+    // sessions stay connected until the device goes away, switching only changes the current one
+    std::shared_ptr<DeviceSession> GetSession(QString udid = "");
+    QStringList GetConnectedDevices();
+    void DisconnectDevice(QString udid);
     void ResetConnection();
     QMap<QString, idevice_connection_type> GetDevices();
     void StartDiagnostics(DiagnosticsMode mode);
     QStringList GetMountedImages();
     bool IsImageMounted();
-    void MountImage(QString image_path, QString signature_path);
-    void Screenshot(QString path);
+    // device operations run on the pool with the session token, closing the session cancels them
+    AsyncTask<bool> MountImage(QString image_path, QString signature_path);
+    AsyncTask<bool> Screenshot(QString path);
 
     static DeviceBridge *Get();
     static void Destroy();
 
 private:
-    void UpdateDeviceInfo();
-    void StartServices();
-    void StartLockdown(bool condition, QStringList service_ids, const std::function<void(QString& service_id, lockdownd_service_descriptor_t& service)>& function);
+    void SetCurrentSession(std::shared_ptr<DeviceSession> session);
+    // attached devices as last reported by usbmuxd, safe to call from any thread
+    QMap<QString, idevice_connection_type> AttachedDevices();
+    void FreeIdleServices();
     void TriggerUpdateDevices(idevice_event_type eventType, idevice_connection_type connectionType, QString udid);
 
     static void DeviceEventCallback(const idevice_event_t* event, void* userdata);
     static ssize_t ImageMounterCallback(void* buf, size_t size, void* userdata);
     static bool m_destroyed;
 
-    idevice_t m_device;
-    lockdownd_client_t m_client;
-    diagnostics_relay_client_t m_diagnostics;
-    mobile_image_mounter_client_t m_imageMounter;
-    screenshotr_client_t m_screenshot;
-    QMap<QString, QJsonDocument> m_deviceInfo;
     QMap<QString, idevice_connection_type> m_deviceList;
+    QMutex m_deviceListMutex;
+    // sessions, the current udid and the connects in flight are guarded together
+    QMap<QString, std::shared_ptr<DeviceSession>> m_sessions;
+    QSet<QString> m_connecting;
+    QMutex m_sessionsMutex;
     QString m_currentUdid;
-    QMutex m_mutex;
+    QTimer* m_idleTimer;
 
     static DeviceBridge *m_instance;
 
@@ -114,30 +136,80 @@ signals:
 
      //AFCUtils
  public:
-     void SyncCrashlogs(QString path);
+     AsyncTask<bool> SyncCrashlogs(QString path);
  private:
-     int afc_upload_file(afc_client_t &afc, const QString &filename, const QString &dstfn, std::function<void(uint32_t,uint32_t)> callback = nullptr);
-     bool afc_upload_dir(afc_client_t &afc, const QString &path, const QString &afcpath, std::function<void(int,int,QString)> callback = nullptr);
-     int afc_copy_crash_reports(afc_client_t &afc, const char* device_directory, const char* host_directory, const char* target_dir = nullptr, const char* filename_filter = nullptr);
-     afc_client_t m_afc;
-     afc_client_t m_crashlog;
-     QString m_crashlogTargetDir;
+     struct AfcTransferStats
+     {
+         qint64 bytes = 0;
+         qint64 msecs = 0;
+         int files = 0;
+         bool network = false;
+     };
+     int afc_upload_file(afc_client_t &afc, const QString &filename, const QString &dstfn, bool network, std::function<void(uint64_t,uint64_t)> callback = nullptr, AfcTransferStats *stats = nullptr);
+     bool afc_upload_dir(afc_client_t &afc, const QString &path, const QString &afcpath, bool network, std::function<void(int,int,QString)> callback = nullptr, AfcTransferStats *stats = nullptr);
+     bool afc_sync_dir(afc_client_t &afc, const QString &udid, const QString &path, const QString &afcpath, bool network, std::function<void(int,int,QString)> callback = nullptr, AfcTransferStats *stats = nullptr);
+     static QString afc_throughput(const AfcTransferStats &stats);
+     struct AfcTransfer
+     {
+         QString source;
+         QString target;
+         qint64 size;
+     };
+     bool afc_upload_files(afc_client_t &afc, QList<AfcTransfer> transfers, int done, int total, bool network, std::function<void(int,int,QString)> callback = nullptr, AfcTransferStats *stats = nullptr);
+     QList<afc_client_t> afc_pool_acquire(afc_client_t &afc, int transfers, std::shared_ptr<DeviceSession> &session);
+     struct CrashlogSyncStats
+     {
+         int copied = 0;
+         int skipped = 0;
+         qint64 copiedBytes = 0;
+         qint64 skippedBytes = 0;
+     };
+     int afc_copy_crash_reports(afc_client_t &afc, const QString &device_directory, const QString &host_directory, QJsonObject &manifest, CrashlogSyncStats &stats, const CancellationToken &token, const char* filename_filter = nullptr);
  signals:
      void CrashlogsStatusChanged(QString messages);
 
      //InstallerBridge
  public:
-     QJsonDocument GetInstalledApps();
-     QMap<QString, QJsonDocument> GetInstalledApps(bool doAsync);
+     QMap<QString, PlistView> GetInstalledApps(std::shared_ptr<DeviceSession> session);
+     QMap<QString, PlistView> GetInstalledApps(bool doAsync);
+     PlistView GetAppInfo(QString bundleId, std::shared_ptr<DeviceSession> session = nullptr);
+     // full instproxy record of one app, answered with AppInfoReceived
+     void RequestAppInfo(QString bundleId);
      void UninstallApp(QString bundleId);
-     void InstallApp(InstallerMode cmd, QString path);
+     AsyncTask<bool> InstallApp(InstallerMode cmd, QString path);
+     void InstallApps(InstallerMode cmd, QStringList udids, QStringList packages, int perDevice = 1);
  private:
-     static void InstallerCallback(plist_t command, plist_t status, void *unused);
-     void TriggetInstallerStatus(QJsonDocument command, QJsonDocument status);
-     instproxy_client_t m_installer;
-     QMap<QString, QJsonDocument> m_installedApps;
+     struct InstallBatch
+     {
+         QList<QPair<QString, QString>> pending;
+         QMap<QString, idevice_connection_type> connections;
+         InstallerMode cmd;
+         QMap<QString, int> running;
+         QSet<QString> runningJobs;
+         int perDevice;
+         int total;
+         int done = 0;
+         int failed = 0;
+         QElapsedTimer elapsed;
+         QMutex mutex;
+     };
+     static void InstallerCallback(plist_t command, plist_t status, void *user_data);
+     void TriggetInstallerStatus(QJsonDocument command, QJsonDocument status, DeviceSession* source);
+     void LoadInstalledApps(std::shared_ptr<DeviceSession> session);
+     void UpdateInstalledApps(std::shared_ptr<DeviceSession> session, QMap<QString, PlistView> newAppList);
+     void UpdateInstalledApp(std::shared_ptr<DeviceSession> session, QString bundleId, bool removed);
+     void DispatchInstallBatch(std::shared_ptr<InstallBatch> batch);
+     bool InstallBatchJob(InstallerMode cmd, const QString& udid, idevice_connection_type type, const QString& package, QString& message, qint64& upload_msecs, qint64& install_msecs);
+     AsyncManager* m_installPool;
+     // udid -> staged name -> size/mtime of the archive already in PublicStaging
+     QMap<QString, QMap<QString, QJsonObject>> m_stagedArchives;
+     QMutex m_stagedMutex;
  signals:
      void InstallerStatusChanged(InstallerMode command, QString bundleId, int percentage, QString message);
+     void InstallJobFinished(QString udid, QString package, bool success, QString message, qint64 uploadMsecs, qint64 installMsecs);
+     void InstallBatchProgress(int done, int total, int failed);
+     void InstallBatchFinished(int succeeded, int failed, qint64 msecs);
+     void AppInfoReceived(QString bundleId, QJsonDocument appInfo);
 
      //SyslogBridge
  public:
@@ -151,11 +223,10 @@ signals:
      void SystemLogsFilter(QString text_or_regex, QString pid_name, QString exclude_text);
      void ReloadLogsFilter();
      LogFilterThread* GetLogHandler() { return m_logHandler; }
-     static QStringList GetPIDOptions(QMap<QString, QJsonDocument>& installed_apps);
+     static QStringList GetPIDOptions(QMap<QString, PlistView>& installed_apps);
  private:
      static void SystemLogsCallback(char c, void *user_data);
      void TriggerSystemLogsReceived(LogPacket log);
-     syslog_relay_client_t m_syslog;
      LogFilterThread* m_logHandler;
  signals:
      void FilterStatusChanged(bool isfiltering);
@@ -190,6 +261,11 @@ signals:
      QStringList GetAttributes(AttrType type);
      void StartMonitor(unsigned int interval_ms, QStringList system_attr, QStringList process_attr);
      void StopMonitor();
+     // samples of the running or last monitor, null before the first StartMonitor
+     std::shared_ptr<PerfMetrics> GetMonitorMetrics();
+     bool ExportMonitorMetrics(QString path);
+     // every sysmontap and graphics sample of a device since its first monitor run
+     std::shared_ptr<PerfStore> GetPerfStore(QString udid = "", bool create = false);
      void GetProcessList();
      void StartFPS(unsigned int interval_ms);
      void StopFPS();
@@ -197,7 +273,11 @@ signals:
      DTXTransport* m_transport;
      DTXConnection* m_connection;
      std::shared_ptr<DTXChannel> m_sysmontapChannel, m_openglChannel;
+     std::shared_ptr<PerfMetrics> m_perfMetrics;
+     QMap<QString, std::shared_ptr<PerfStore>> m_perfStores;
+     QMutex m_perfMutex;
  signals:
+     void MonitorSampled(qint64 timestamp);
 };
 
 #endif // DEVICEBRIDGE_H
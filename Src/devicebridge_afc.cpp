@@ -3,6 +3,11 @@
 #include <QDir>
 #include <QDirIterator>
 #include <QFileInfo>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QCryptographicHash>
 #include <libimobiledevice-glue/utils.h>
 #include <dirent.h>
 
@@ -14,15 +19,20 @@
 #include <unistd.h>
 #endif
 #include <string.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <QElapsedTimer>
 #include "utils.h"
 
-int DeviceBridge::afc_upload_file(afc_client_t &afc, const QString &filename, const QString &dstfn, std::function<void(uint32_t,uint32_t)> callback)
+int DeviceBridge::afc_upload_file(afc_client_t &afc, const QString &filename, const QString &dstfn, bool network, std::function<void(uint64_t,uint64_t)> callback, AfcTransferStats *stats)
 {
     FILE *f = NULL;
     uint64_t af = 0;
-    char buf[1048576];
-    size_t total_bytes = QFileInfo(filename).size();
-    size_t uploaded_bytes = 0;
+    uint64_t total_bytes = QFileInfo(filename).size();
+    uint64_t uploaded_bytes = 0;
+    uint64_t read_bytes = 0;
 
     f = fopen(filename.toUtf8().data(), "rb");
     if (!f) {
@@ -36,37 +46,88 @@ int DeviceBridge::afc_upload_file(afc_client_t &afc, const QString &filename, co
         return -2;
     }
 
-    size_t amount = 0;
-    do {
-        amount = fread(buf, 1, sizeof(buf), f);
-        if (amount > 0) {
-            uint32_t written, total = 0;
-            afc_error_t aerr = AFC_E_SUCCESS;
-            while (total < amount) {
-                written = 0;
-                aerr = afc_file_write(afc, af, buf, amount, &written);
-                if (aerr != AFC_E_SUCCESS) {
-                    break;
-                }
-                total += written;
-                uploaded_bytes += written;
-                if (callback) callback(uploaded_bytes, total_bytes);
-            }
-            if (total != amount) {
-                fprintf(stderr, "Error: wrote only %u of %u\n", total, (uint32_t)amount);
-                afc_file_close(afc, af);
-                fclose(f);
-                return aerr;
+    // network links pay more per round trip, start them with bigger writes
+    size_t chunk = network ? AFC_CHUNK_NETWORK : AFC_CHUNK_USB;
+    std::vector<char> buffers[2];
+    int current = 0;
+    auto read_chunk = [f, &read_bytes, &buffers, total_bytes](int index, size_t size) -> size_t {
+        size = (size_t)qMin<uint64_t>(size, qMax<uint64_t>(total_bytes - qMin(read_bytes, total_bytes), 1));
+        if (buffers[index].size() < size)
+            buffers[index].resize(size);
+        size_t amount = fread(buffers[index].data(), 1, size, f);
+        read_bytes += amount;
+        return amount;
+    };
+
+    QElapsedTimer elapsed, progress;
+    elapsed.start();
+    progress.start();
+    size_t amount = read_chunk(current, chunk);
+    while (amount > 0) {
+        // read the next chunk from disk while this one goes to the device
+        bool more = read_bytes < total_bytes;
+        std::future<size_t> next = std::async(more ? std::launch::async : std::launch::deferred, read_chunk, current ^ 1, chunk);
+
+        QElapsedTimer write_time;
+        write_time.start();
+        const char* buf = buffers[current].data();
+        uint32_t written, total = 0;
+        afc_error_t aerr = AFC_E_SUCCESS;
+        while (total < amount) {
+            written = 0;
+            aerr = afc_file_write(afc, af, buf + total, amount - total, &written);
+            if (aerr != AFC_E_SUCCESS) {
+                break;
             }
+            total += written;
+        }
+        if (total != amount) {
+            next.wait();
+            fprintf(stderr, "Error: wrote only %u of %u\n", total, (uint32_t)amount);
+            afc_file_close(afc, af);
+            fclose(f);
+            return aerr;
+        }
+        uploaded_bytes += total;
+
+        // keep each write in the sweet spot between round trip overhead and progress latency
+        qint64 msecs = write_time.elapsed();
+        if (amount == chunk && msecs < AFC_CHUNK_FAST_MS && chunk < AFC_CHUNK_MAX)
+            chunk *= 2;
+        else if (msecs > AFC_CHUNK_SLOW_MS && chunk > AFC_CHUNK_MIN)
+            chunk /= 2;
+
+        if (callback && (progress.elapsed() >= AFC_PROGRESS_INTERVAL_MS || uploaded_bytes >= total_bytes)) {
+            callback(uploaded_bytes, total_bytes);
+            progress.restart();
         }
-    } while (amount > 0);
+
+        amount = next.get();
+        current ^= 1;
+    }
 
     afc_file_close(afc, af);
     fclose(f);
+
+    if (stats) {
+        stats->bytes += uploaded_bytes;
+        stats->msecs += elapsed.elapsed();
+        stats->files++;
+        stats->network = network;
+    }
     return AFC_E_SUCCESS;
 }
 
-bool DeviceBridge::afc_upload_dir(afc_client_t &afc, const QString &path, const QString &afcpath, std::function<void(int,int,QString)> callback)
+QString DeviceBridge::afc_throughput(const AfcTransferStats &stats)
+{
+    double seconds = qMax<qint64>(stats.msecs, 1) / 1000.0;
+    return QString("%1 in %2s, %3/s over %4").arg(BytesToString(stats.bytes))
+        .arg(seconds, 0, 'f', 1)
+        .arg(BytesToString(quint64(stats.bytes / seconds)))
+        .arg(stats.network ? "network" : "usb");
+}
+
+bool DeviceBridge::afc_upload_dir(afc_client_t &afc, const QString &path, const QString &afcpath, bool network, std::function<void(int,int,QString)> callback, AfcTransferStats *stats)
 {
     QStringList list_dirs, list_files;
     QDir dirpath(path);
@@ -93,25 +154,228 @@ bool DeviceBridge::afc_upload_dir(afc_client_t &afc, const QString &path, const
             return false;
         }
     }
+
+    QList<AfcTransfer> transfers;
     foreach (QString file_name, list_files)
+        transfers << AfcTransfer { file_name, afcpath + "/" + dirpath.relativeFilePath(file_name), QFileInfo(file_name).size() };
+    return afc_upload_files(afc, transfers, idx, total, network, callback, stats);
+}
+
+bool DeviceBridge::afc_sync_dir(afc_client_t &afc, const QString &udid, const QString &path, const QString &afcpath, bool network, std::function<void(int,int,QString)> callback, AfcTransferStats *stats)
+{
+    // what was staged last time for this device, keyed by staging path then relative file path
+    QString manifestPath = GetDirectory(DIRECTORY_TYPE::LOCALDATA) + "staging_" + udid + ".json";
+    QJsonObject manifest;
+    QFile manifestFile(manifestPath);
+    if (manifestFile.open(QIODevice::ReadOnly))
     {
-        idx++;
-        QString targetpath = afcpath + "/" + dirpath.relativeFilePath(file_name);
-        auto afc_callback = [&](uint32_t uploaded_bytes, uint32_t total_bytes)
+        manifest = QJsonDocument::fromJson(manifestFile.readAll()).object();
+        manifestFile.close();
+    }
+
+    // installd may have cleaned the staging area, trust the manifest only if the directory is still there
+    QJsonObject staged = manifest[afcpath].toObject();
+    char **info = NULL;
+    if (afc_get_file_info(afc, afcpath.toUtf8().data(), &info) != AFC_E_SUCCESS || !info)
+        staged = QJsonObject();
+    if (info)
+        afc_dictionary_free(info);
+
+    QDir dirpath(path);
+    QStringList list_dirs;
+    list_dirs << path;
+    QDirIterator it_dir(path, QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it_dir.hasNext())
+        list_dirs << it_dir.next();
+
+    QList<AfcTransfer> transfers;
+    QJsonObject current;
+    int files = 0;
+    QDirIterator it_file(path, QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it_file.hasNext())
+    {
+        QString file_name = it_file.next();
+        QString relative = dirpath.relativeFilePath(file_name);
+        QFileInfo file_info(file_name);
+        QJsonObject known = staged[relative].toObject();
+
+        QJsonObject entry;
+        entry["size"] = file_info.size();
+        entry["mtime"] = file_info.lastModified().toMSecsSinceEpoch();
+        // size and mtime untouched means the content hash is still valid, skip rehashing
+        if (known["size"].toInteger() == file_info.size() && known["mtime"].toInteger() == entry["mtime"].toInteger())
         {
-            if (callback) callback(idx, total, QString::asprintf("(%s of %s) Sending `%s' to device...",
-                                                                 BytesToString(uploaded_bytes).toUtf8().data(),
-                                                                 BytesToString(total_bytes).toUtf8().data(),
-                                                                 targetpath.toUtf8().data()));
-        };
-        int result = afc_upload_file(afc, file_name, targetpath, afc_callback);
-        if (result != 0)
+            entry["hash"] = known["hash"];
+        }
+        else
         {
-            if (callback) callback(idx, total, QString::asprintf("Can't send `%s' to device : afc error code %d", targetpath.toUtf8().data(), result));
+            QFile file(file_name);
+            QCryptographicHash hash(QCryptographicHash::Sha1);
+            if (file.open(QIODevice::ReadOnly))
+                hash.addData(&file);
+            entry["hash"] = QString(hash.result().toHex());
+        }
+        current[relative] = entry;
+        files++;
+
+        if (known["size"].toInteger() != file_info.size() || known["hash"].toString() != entry["hash"].toString())
+            transfers << AfcTransfer { file_name, afcpath + "/" + relative, file_info.size() };
+    }
+
+    // directories are recorded too, one that went away is removed once its files are gone
+    foreach (const QString& dir_name, list_dirs.mid(1))
+    {
+        QJsonObject entry;
+        entry["dir"] = true;
+        current[dirpath.relativeFilePath(dir_name)] = entry;
+    }
+
+    // files and directories that went away from the build must not linger in the staged bundle
+    QStringList stale, stale_dirs;
+    foreach (const QString& relative, staged.keys())
+    {
+        if (current.contains(relative))
+            continue;
+        if (staged[relative].toObject()["dir"].toBool())
+            stale_dirs << relative;
+        else
+            stale << relative;
+    }
+    // reverse order puts a nested directory before its parent
+    std::sort(stale_dirs.begin(), stale_dirs.end(), std::greater<QString>());
+    stale << stale_dirs;
+
+    int idx = 0;
+    int total = list_dirs.count() + stale.count() + transfers.count();
+    foreach (const QString& relative, stale)
+    {
+        idx++;
+        QString targetpath = afcpath + "/" + relative;
+        if (callback) callback(idx, total, QString::asprintf("Removing stale `%s' from device...", targetpath.toUtf8().data()));
+        afc_remove_path(afc, targetpath.toUtf8().data());
+    }
+    foreach (QString dir_name, list_dirs)
+    {
+        idx++;
+        QString targetpath = afcpath + "/" + dirpath.relativeFilePath(dir_name);
+        afc_error_t result = afc_make_directory(afc, targetpath.toUtf8().data());
+        if (result != AFC_E_SUCCESS)
+        {
+            if (callback) callback(idx, total, QString::asprintf("Can't add `%s' to device : afc error code %d", targetpath.toUtf8().data(), result));
             return false;
         }
     }
-    return true;
+    if (callback) callback(idx, total, QString("Sending %1 changed file(s), %2 unchanged").arg(transfers.count()).arg(files - transfers.count()));
+
+    // drop the record before touching the device, a partial upload must not look complete next time
+    manifest.remove(afcpath);
+    bool result = afc_upload_files(afc, transfers, idx, total, network, callback, stats);
+    if (result)
+        manifest[afcpath] = current;
+
+    QDir().mkpath(GetDirectory(DIRECTORY_TYPE::LOCALDATA));
+    QSaveFile saveFile(manifestPath);
+    if (saveFile.open(QIODevice::WriteOnly))
+    {
+        saveFile.write(QJsonDocument(manifest).toJson(QJsonDocument::Compact));
+        saveFile.commit();
+    }
+    return result;
+}
+
+bool DeviceBridge::afc_upload_files(afc_client_t &afc, QList<AfcTransfer> transfers, int done, int total, bool network, std::function<void(int,int,QString)> callback, AfcTransferStats *stats)
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    // biggest first so the long transfers start early, the tail is filled with small files
+    std::sort(transfers.begin(), transfers.end(), [](const AfcTransfer& a, const AfcTransfer& b) {
+        return a.size > b.size;
+    });
+
+    std::shared_ptr<DeviceSession> session;
+    QList<afc_client_t> clients = afc_pool_acquire(afc, transfers.count(), session);
+    std::mutex queue_mutex;
+    std::atomic<bool> failed(false);
+    int front = 0, back = transfers.count() - 1;
+
+    auto worker = [&](afc_client_t client, bool prefer_large) {
+        bool take_large = prefer_large;
+        while (!failed)
+        {
+            AfcTransfer transfer;
+            int idx = 0;
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                if (front > back)
+                    return;
+                transfer = take_large ? transfers[front++] : transfers[back--];
+                idx = ++done;
+            }
+            take_large = !take_large;
+
+            auto afc_callback = [&](uint64_t uploaded_bytes, uint64_t total_bytes)
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                if (callback) callback(idx, total, QString::asprintf("(%s of %s) Sending `%s' to device...",
+                                                                     BytesToString(uploaded_bytes).toUtf8().data(),
+                                                                     BytesToString(total_bytes).toUtf8().data(),
+                                                                     transfer.target.toUtf8().data()));
+            };
+            AfcTransferStats file_stats;
+            int result = afc_upload_file(client, transfer.source, transfer.target, network, afc_callback, &file_stats);
+            if (result == 0 && stats)
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                stats->bytes += file_stats.bytes;
+                stats->files += file_stats.files;
+                stats->network = file_stats.network;
+            }
+            else if (result != 0)
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                if (callback && !failed) callback(idx, total, QString::asprintf("Can't send `%s' to device : afc error code %d", transfer.target.toUtf8().data(), result));
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < clients.count(); i++)
+        threads.emplace_back(worker, clients[i], i % 2 == 0);
+    worker(clients[0], true);
+    for (std::thread& thread : threads)
+        thread.join();
+    if (session)
+        session->ReturnAfcPool(clients.mid(1));
+
+    // connections run side by side, wall clock is what the user waits for
+    if (stats)
+        stats->msecs += elapsed.elapsed();
+    return !failed;
+}
+
+QList<afc_client_t> DeviceBridge::afc_pool_acquire(afc_client_t &afc, int transfers, std::shared_ptr<DeviceSession> &session)
+{
+    QList<afc_client_t> clients;
+    clients << afc;
+
+    // only a session's own afc client has a pool, install batch jobs bring their own connection
+    {
+        QMutexLocker locker(&m_sessionsMutex);
+        foreach (const auto& item, m_sessions)
+        {
+            if (item->Afc() == afc)
+                session = item;
+        }
+    }
+    if (!session)
+        return clients;
+
+    // extra com.apple.afc connections are opened once and kept until the afc service goes idle,
+    // a concurrent upload on the same device gets what is left and the caller returns them when done
+    clients << session->CheckoutAfcPool(qMin(AFC_POOL_SIZE - 1, transfers - 1));
+    return clients;
 }
 
 int file_exists(const char* path)
@@ -124,197 +388,175 @@ int file_exists(const char* path)
 #endif
 }
 
-int DeviceBridge::afc_copy_crash_reports(afc_client_t &afc, const char* device_directory, const char* host_directory, const char* target_dir, const char* filename_filter)
+int DeviceBridge::afc_copy_crash_reports(afc_client_t &afc, const QString &device_directory, const QString &host_directory, QJsonObject &manifest, CrashlogSyncStats &stats, const CancellationToken &token, const char* filename_filter)
 {
     afc_error_t afc_error;
-    int k;
     int res = -1;
     int crash_report_count = 0;
+    bool cancelled = false;
     uint64_t handle;
-    char source_filename[512];
-    char target_filename[512];
-    m_crashlogTargetDir = (target_dir == nullptr ? m_crashlogTargetDir : target_dir);
-    const char* target_directory = (target_dir == nullptr ? m_crashlogTargetDir.toUtf8().data() : target_dir);
 
     if (!afc)
         return res;
 
     char** list = NULL;
-        afc_error = afc_read_directory(afc, device_directory, &list);
-        if (afc_error != AFC_E_SUCCESS) {
-            emit CrashlogsStatusChanged(QString("ERROR: Could not read device directory '%1'").arg(device_directory));
-            return res;
-        }
+    afc_error = afc_read_directory(afc, device_directory.toUtf8().data(), &list);
+    if (afc_error != AFC_E_SUCCESS) {
+        emit CrashlogsStatusChanged(QString("ERROR: Could not read device directory '%1'").arg(device_directory));
+        return res;
+    }
 
-        /* ensure we have a trailing slash */
-        strcpy(source_filename, device_directory);
-        if (source_filename[strlen(source_filename)-1] != '/') {
-            strcat(source_filename, "/");
-        }
-        int device_directory_length = strlen(source_filename);
+    /* ensure we have a trailing slash */
+    QString source_directory = device_directory.endsWith('/') ? device_directory : device_directory + "/";
+    QString target_directory = host_directory.endsWith('/') ? host_directory : host_directory + "/";
 
-        /* ensure we have a trailing slash */
-        strcpy(target_filename, host_directory);
-        if (target_filename[strlen(target_filename)-1] != '/') {
-            strcat(target_filename, "/");
+    /* loop over file entries */
+    for (int k = 0; list[k]; k++) {
+        /* the session went away, what was copied so far stays in the manifest */
+        if (token.IsCancelled()) {
+            cancelled = true;
+            break;
+        }
+        if (!strcmp(list[k], ".") || !strcmp(list[k], "..")) {
+            continue;
         }
-        int host_directory_length = strlen(target_filename);
 
-        /* loop over file entries */
-        for (k = 0; list[k]; k++) {
-            if (!strcmp(list[k], ".") || !strcmp(list[k], "..")) {
-                continue;
-            }
+        /* assemble absolute source and target filenames */
+        QString entry_name = QString::fromUtf8(list[k]);
+        QString source_filename = source_directory + entry_name;
+#ifdef WIN32
+        /* replace every ':' with '-' since ':' is an illegal character for file names in windows */
+        entry_name.replace(':', '-');
+#endif
+        /* make sure to strip ".synced" extension as seen on iOS 5 */
+        if (entry_name.endsWith(".synced"))
+            entry_name.chop(7);
+        QString target_filename = target_directory + entry_name;
+
+        /* get file information */
+        char **fileinfo = NULL;
+        afc_get_file_info(afc, source_filename.toUtf8().data(), &fileinfo);
+        if (!fileinfo) {
+            emit CrashlogsStatusChanged(QString("Failed to read information for '%1'. Skipping...").arg(source_filename));
+            continue;
+        }
 
-            char **fileinfo = NULL;
-            struct stat stbuf;
-            memset(&stbuf, '\0', sizeof(struct stat));
+        /* parse file information */
+        QString file_type;
+        qint64 file_size = 0;
+        qint64 file_mtime = 0;
+        for (int i = 0; fileinfo[i]; i+=2) {
+            if (!strcmp(fileinfo[i], "st_size")) {
+                file_size = atoll(fileinfo[i+1]);
+            } else if (!strcmp(fileinfo[i], "st_ifmt")) {
+                file_type = fileinfo[i+1];
+            } else if (!strcmp(fileinfo[i], "st_mtime")) {
+                file_mtime = atoll(fileinfo[i+1]) / 1000000000;
+            } else if (!strcmp(fileinfo[i], "LinkTarget")) {
+                /* report latest crash report filename */
+                emit CrashlogsStatusChanged(QString("Link: %1").arg(target_filename));
+
+                /* remove any previous symlink */
+                if (file_exists(target_filename.toUtf8().data())) {
+                    remove(target_filename.toUtf8().data());
+                }
 
-            /* assemble absolute source filename */
-            strcpy(((char*)source_filename) + device_directory_length, list[k]);
+#ifndef WIN32
+                /* use relative filename */
+                char* b = strrchr(fileinfo[i+1], '/');
+                if (b == NULL) {
+                    b = fileinfo[i+1];
+                } else {
+                    b++;
+                }
 
-            /* assemble absolute target filename */
-    #ifdef WIN32
-            /* replace every ':' with '-' since ':' is an illegal character for file names in windows */
-            char* current_pos = strchr(list[k], ':');
-            while (current_pos) {
-                *current_pos = '-';
-                current_pos = strchr(current_pos, ':');
-            }
-    #endif
-            char* p = strrchr(list[k], '.');
-            if (p != NULL && !strncmp(p, ".synced", 7)) {
-                /* make sure to strip ".synced" extension as seen on iOS 5 */
-                int newlen = strlen(list[k]) - 7;
-                strncpy(((char*)target_filename) + host_directory_length, list[k], newlen);
-                target_filename[host_directory_length + newlen] = '\0';
-            } else {
-                strcpy(((char*)target_filename) + host_directory_length, list[k]);
+                /* create a symlink pointing to latest log */
+                if (symlink(b, target_filename.toUtf8().data()) < 0) {
+                    fprintf(stderr, "Can't create symlink to %s\n", b);
+                }
+#endif
+                res = 0;
             }
+        }
 
-            /* get file information */
-            afc_get_file_info(afc, source_filename, &fileinfo);
-            if (!fileinfo) {
-                emit CrashlogsStatusChanged(QString("Failed to read information for '%1'. Skipping...").arg(source_filename));
-                continue;
-            }
+        /* free file information */
+        afc_dictionary_free(fileinfo);
 
-            /* parse file information */
-            int i;
-            for (i = 0; fileinfo[i]; i+=2) {
-                if (!strcmp(fileinfo[i], "st_size")) {
-                    stbuf.st_size = atoll(fileinfo[i+1]);
-                } else if (!strcmp(fileinfo[i], "st_ifmt")) {
-                    if (!strcmp(fileinfo[i+1], "S_IFREG")) {
-                        stbuf.st_mode = S_IFREG;
-                    } else if (!strcmp(fileinfo[i+1], "S_IFDIR")) {
-                        stbuf.st_mode = S_IFDIR;
-                    } else if (!strcmp(fileinfo[i+1], "S_IFLNK")) {
-                        stbuf.st_mode = S_IFLNK;
-                    } else if (!strcmp(fileinfo[i+1], "S_IFBLK")) {
-                        stbuf.st_mode = S_IFBLK;
-                    } else if (!strcmp(fileinfo[i+1], "S_IFCHR")) {
-                        stbuf.st_mode = S_IFCHR;
-                    } else if (!strcmp(fileinfo[i+1], "S_IFIFO")) {
-                        stbuf.st_mode = S_IFIFO;
-                    } else if (!strcmp(fileinfo[i+1], "S_IFSOCK")) {
-                        stbuf.st_mode = S_IFSOCK;
-                    }
-                } else if (!strcmp(fileinfo[i], "st_nlink")) {
-                    stbuf.st_nlink = atoi(fileinfo[i+1]);
-                } else if (!strcmp(fileinfo[i], "st_mtime")) {
-                    stbuf.st_mtime = (time_t)(atoll(fileinfo[i+1]) / 1000000000);
-                } else if (!strcmp(fileinfo[i], "LinkTarget")) {
-                    /* report latest crash report filename */
-                    emit CrashlogsStatusChanged(QString("Link: %1").arg(target_filename));
-
-                    /* remove any previous symlink */
-                    if (file_exists(target_filename)) {
-                        remove(target_filename);
-                    }
-
-    #ifndef WIN32
-                    /* use relative filename */
-                    char* b = strrchr(fileinfo[i+1], '/');
-                    if (b == NULL) {
-                        b = fileinfo[i+1];
-                    } else {
-                        b++;
-                    }
-
-                    /* create a symlink pointing to latest log */
-                    if (symlink(b, target_filename) < 0) {
-                        fprintf(stderr, "Can't create symlink to %s\n", b);
-                    }
-    #endif
-                    res = 0;
-                }
+        /* recurse into child directories */
+        if (file_type == "S_IFDIR") {
+            QDir().mkpath(target_filename);
+            res = afc_copy_crash_reports(afc, source_filename, target_filename, manifest, stats, token, filename_filter);
+        }
+        else if (file_type == "S_IFREG")
+        {
+            if (filename_filter != NULL && !source_filename.contains(filename_filter)) {
+                continue;
             }
 
-            /* free file information */
-            afc_dictionary_free(fileinfo);
-
-            /* recurse into child directories */
-            if (S_ISDIR(stbuf.st_mode)) {
-    #ifdef WIN32
-                mkdir(target_filename);
-    #else
-                mkdir(target_filename, 0755);
-    #endif
-                res = afc_copy_crash_reports(afc, source_filename, target_filename, nullptr, filename_filter);
+            /* unchanged since the last sync and still on disk, nothing to transfer */
+            QJsonObject known = manifest[source_filename].toObject();
+            if (known["size"].toInteger() == file_size && known["mtime"].toInteger() == file_mtime
+                && QFileInfo(target_filename).size() == file_size) {
+                stats.skipped++;
+                stats.skippedBytes += file_size;
+                res = 0;
+                continue;
             }
-            else if (S_ISREG(stbuf.st_mode))
-            {
-                if (filename_filter != NULL && strstr(source_filename, filename_filter) == NULL) {
-                    continue;
-                }
-
-                /* copy file to host */
-                afc_error = afc_file_open(afc, source_filename, AFC_FOPEN_RDONLY, &handle);
-                if(afc_error != AFC_E_SUCCESS) {
-                    if (afc_error == AFC_E_OBJECT_NOT_FOUND) {
-                        continue;
-                    }
-                    emit CrashlogsStatusChanged(QString("Unable to open device file '%1' (%2). Skipping...").arg(source_filename, afc_error));
-                    continue;
-                }
 
-                FILE* output = fopen(target_filename, "wb");
-                if(output == NULL) {
-                    emit CrashlogsStatusChanged(QString("Unable to open local file '%1'. Skipping...").arg(target_filename));
-                    afc_file_close(afc, handle);
+            /* copy file to host */
+            afc_error = afc_file_open(afc, source_filename.toUtf8().data(), AFC_FOPEN_RDONLY, &handle);
+            if(afc_error != AFC_E_SUCCESS) {
+                if (afc_error == AFC_E_OBJECT_NOT_FOUND) {
                     continue;
                 }
+                emit CrashlogsStatusChanged(QString("Unable to open device file '%1' (%2). Skipping...").arg(source_filename).arg(afc_error));
+                continue;
+            }
 
-                emit CrashlogsStatusChanged(QString("Copy: %1...").arg(target_filename));
+            FILE* output = fopen(target_filename.toUtf8().data(), "wb");
+            if(output == NULL) {
+                emit CrashlogsStatusChanged(QString("Unable to open local file '%1'. Skipping...").arg(target_filename));
+                afc_file_close(afc, handle);
+                continue;
+            }
 
-                uint32_t bytes_read = 0;
-                uint32_t bytes_total = 0;
-                unsigned char data[0x1000];
+            emit CrashlogsStatusChanged(QString("Copy: %1...").arg(target_filename));
 
-                afc_error = afc_file_read(afc, handle, (char*)data, 0x1000, &bytes_read);
-                while(afc_error == AFC_E_SUCCESS && bytes_read > 0) {
-                    fwrite(data, 1, bytes_read, output);
-                    bytes_total += bytes_read;
-                    afc_error = afc_file_read(afc, handle, (char*)data, 0x1000, &bytes_read);
-                }
-                afc_file_close(afc, handle);
-                fclose(output);
+            uint32_t bytes_read = 0;
+            qint64 bytes_total = 0;
+            unsigned char data[0x10000];
 
-                if ((uint32_t)stbuf.st_size != bytes_total) {
-                    emit CrashlogsStatusChanged("File size mismatch. Skipping...");
-                    continue;
-                }
+            afc_error = afc_file_read(afc, handle, (char*)data, sizeof(data), &bytes_read);
+            while(afc_error == AFC_E_SUCCESS && bytes_read > 0) {
+                fwrite(data, 1, bytes_read, output);
+                bytes_total += bytes_read;
+                afc_error = afc_file_read(afc, handle, (char*)data, sizeof(data), &bytes_read);
+            }
+            afc_file_close(afc, handle);
+            fclose(output);
 
-                crash_report_count++;
-                res = 0;
+            if (file_size != bytes_total) {
+                emit CrashlogsStatusChanged("File size mismatch. Skipping...");
+                continue;
             }
-        }
-        afc_dictionary_free(list);
 
-        /* no reports, no error */
-        if (crash_report_count == 0)
+            QJsonObject synced;
+            synced["size"] = file_size;
+            synced["mtime"] = file_mtime;
+            manifest[source_filename] = synced;
+            stats.copied++;
+            stats.copiedBytes += bytes_total;
+            crash_report_count++;
             res = 0;
+        }
+    }
+    afc_dictionary_free(list);
 
-        return res;
+    /* no reports, no error */
+    if (crash_report_count == 0)
+        res = 0;
+    if (cancelled)
+        res = -1;
+
+    return res;
 }
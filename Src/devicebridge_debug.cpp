@@ -80,9 +80,11 @@ void DeviceBridge::StartDebugging(QString bundleId, bool detach_after_start, QSt
 {
     AsyncManager::Get()->StartAsyncRequest([this, bundleId, detach_after_start, parameters, arguments]()
     {
+        auto session = GetSession();
+        QMap<QString, PlistView> installedApps = session ? session->GetInstalledApps() : QMap<QString, PlistView>();
         QString container;
-        if (m_installedApps.contains(bundleId)) {
-            container = m_installedApps[bundleId]["Container"].toString();
+        if (installedApps.contains(bundleId)) {
+            container = installedApps[bundleId]["Container"].toString();
         }
         else {
             emit DebuggerReceived("App not installed yet", true);
@@ -90,7 +92,7 @@ void DeviceBridge::StartDebugging(QString bundleId, bool detach_after_start, QSt
         }
 
         /* start and connect to debugserver */
-        if (debugserver_client_start_service(m_device, &m_debugger, TOOL_NAME) != DEBUGSERVER_E_SUCCESS) {
+        if (debugserver_client_start_service(session->Device(), &m_debugger, TOOL_NAME) != DEBUGSERVER_E_SUCCESS) {
             emit DebuggerReceived(
                     "Could not start com.apple.debugserver!\n"
                     "Please make sure to mount the developer disk image first:\n"
@@ -171,7 +173,7 @@ void DeviceBridge::StartDebugging(QString bundleId, bool detach_after_start, QSt
 
         /* set arguments and run app */
         qDebug() << "Setting argv...";
-        QString path = m_installedApps[bundleId]["Path"].toString() + "/" + m_installedApps[bundleId]["CFBundleExecutable"].toString();
+        QString path = installedApps[bundleId]["Path"].toString() + "/" + installedApps[bundleId]["CFBundleExecutable"].toString();
         QStringList args = QStringList() << path << arguments.split(" ");
         char **app_argv = (char**)malloc(sizeof(char*) * (args.count() + 1));
         int idx = 0;
@@ -301,7 +303,7 @@ void DeviceBridge::StartDebugging(QString bundleId, bool detach_after_start, QSt
         }
         CloseDebugger();
         emit DebuggerReceived("Debugger stopped..", true);
-    });
+    }, TASK_BACKGROUND);
 }
 
 void DeviceBridge::StopDebugging()
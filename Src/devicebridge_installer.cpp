@@ -3,6 +3,11 @@
 #include <QMessageBox>
 #include <QFileInfo>
 #include <QJsonObject>
+#include <QDir>
+#include <QSaveFile>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+#include <future>
 #include <zip.h>
 #include <libgen.h>
 #include <stdio.h>
@@ -11,88 +16,229 @@
 #include "common/json.h"
 #include "extended_plist.h"
 #include "extended_zip.h"
+#include "userconfigs.h"
 
-QJsonDocument DeviceBridge::GetInstalledApps()
+// one view per app keyed by bundle id, keys are only converted when the UI reads them
+static QMap<QString, PlistView> AppListFromArray(plist_t apps)
 {
-    QJsonDocument jsonArray;
-    if (!m_installer) {
-        return jsonArray;
+    QMap<QString, PlistView> appList;
+    if (!apps || plist_get_node_type(apps) != PLIST_ARRAY)
+        return appList;
+
+    for (uint32_t idx = 0; idx < plist_array_get_size(apps); idx++)
+    {
+        PlistView app_info(plist_copy(plist_array_get_item(apps, idx)));
+        QString bundle_id = app_info["CFBundleIdentifier"].toString();
+        if (!bundle_id.isEmpty())
+            appList[bundle_id] = app_info;
+    }
+    return appList;
+}
+
+QMap<QString, PlistView> DeviceBridge::GetInstalledApps(std::shared_ptr<DeviceSession> session)
+{
+    QMap<QString, PlistView> appList;
+    auto installer = session ? session->AcquireService(SERVICE_INSTALLER) : nullptr;
+    if (!installer) {
+        return appList;
     }
 
+    /* only what the app list, pid filter and debugger read, GetAppInfo has the full record */
     plist_t client_opts = instproxy_client_options_new();
     instproxy_client_options_add(client_opts, "ApplicationType", "User", nullptr);
+    instproxy_client_options_set_return_attributes(client_opts, "CFBundleIdentifier", "CFBundleExecutable", "CFBundleName",
+                                                   "CFBundleShortVersionString", "CFBundleVersion", "SignerIdentity",
+                                                   "Container", "Path", nullptr);
 
     plist_t apps = nullptr;
-    instproxy_error_t err = instproxy_browse(m_installer, client_opts, &apps);
+    instproxy_error_t err = instproxy_browse(session->Installer(), client_opts, &apps);
+    instproxy_client_options_free(client_opts);
     if (err != INSTPROXY_E_SUCCESS || !apps || (plist_get_node_type(apps) != PLIST_ARRAY)) {
         emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: instproxy_browse returnd an invalid plist!");
-        return jsonArray;
+        if (apps)
+            plist_free(apps);
+        return appList;
     }
 
-    jsonArray = PlistToJson(apps);
+    appList = AppListFromArray(apps);
     plist_free(apps);
-    return jsonArray;
+    return appList;
 }
 
-QMap<QString, QJsonDocument> DeviceBridge::GetInstalledApps(bool doAsync)
+PlistView DeviceBridge::GetAppInfo(QString bundleId, std::shared_ptr<DeviceSession> session)
 {
-    if (!m_installer)
-        return m_installedApps;
+    PlistView appInfo;
+    if (!session)
+        session = GetSession();
+    auto installer = session ? session->AcquireService(SERVICE_INSTALLER) : nullptr;
+    if (!installer) {
+        return appInfo;
+    }
 
-    auto apps_update = [this](){
-        QJsonDocument jsonArray = GetInstalledApps();
-        QMap<QString, QJsonDocument> newAppList;
-        for (int idx = 0; idx < jsonArray.array().count(); idx++)
-        {
-            QString bundle_id = jsonArray[idx]["CFBundleIdentifier"].toString();
-            QJsonDocument app_info;
-            app_info.setObject(jsonArray[idx].toObject());
-            newAppList[bundle_id] = app_info;
-        }
-        m_logHandler->UpdateInstalledList(newAppList);
-        m_mutex.lock();
-        m_installedApps = newAppList;
-        m_mutex.unlock();
+    plist_t apps = nullptr;
+    QByteArray appid = bundleId.toUtf8();
+    const char* appids[] = { appid.constData(), nullptr };
+    if (instproxy_lookup(session->Installer(), appids, nullptr, &apps) == INSTPROXY_E_SUCCESS && apps) {
+        plist_t app = plist_dict_get_item(apps, appid.constData());
+        if (app)
+            appInfo = PlistView(plist_copy(app));
+    }
+    if (apps)
+        plist_free(apps);
+    return appInfo;
+}
+
+void DeviceBridge::RequestAppInfo(QString bundleId)
+{
+    auto session = GetSession();
+    AsyncManager::Get()->StartAsyncRequest([this, session, bundleId]() {
+        PlistView appInfo = session ? GetAppInfo(bundleId, session) : PlistView();
+        // the cached record is better than nothing when the lookup fails
+        if (!appInfo.IsValid() && session)
+            appInfo = session->GetInstalledApps().value(bundleId);
+        // the dialog shows everything, this is the one place the whole record is converted
+        emit AppInfoReceived(bundleId, QJsonDocument::fromJson(appInfo.toJson()));
+    });
+}
+
+QMap<QString, PlistView> DeviceBridge::GetInstalledApps(bool doAsync)
+{
+    auto session = GetSession();
+    if (!session)
+        return QMap<QString, PlistView>();
+
+    // the registry is kept current by install/uninstall callbacks, a browse only catches changes made elsewhere
+    QElapsedTimer& refreshed = session->InstalledAppsRefreshed();
+    if (refreshed.isValid() && refreshed.elapsed() < APPS_REFRESH_INTERVAL_MS)
+        return session->GetInstalledApps();
+    refreshed.start();
+
+    auto apps_update = [this, session](){
+        UpdateInstalledApps(session, GetInstalledApps(session));
     };
 
     if (doAsync)
     {
         AsyncManager::Get()->StartAsyncRequest([apps_update]() {
             apps_update();
-        });
+        }, TASK_BACKGROUND);
     }
     else
     {
         apps_update();
     }
-    return m_installedApps;
+    return session->GetInstalledApps();
+}
+
+void DeviceBridge::UpdateInstalledApps(std::shared_ptr<DeviceSession> session, QMap<QString, PlistView> newAppList)
+{
+    session->SetInstalledApps(newAppList);
+    if (session->GetUdid() == GetCurrentUdid())
+        m_logHandler->UpdateInstalledList(newAppList);
+
+    // cached as the binary plist instproxy returned, reading it back needs no json round trip
+    plist_t apps = plist_new_array();
+    foreach (const auto& app_info, newAppList)
+    {
+        plist_t item = app_info.Copy();
+        if (item)
+            plist_array_append_item(apps, item);
+    }
+    char* bin = nullptr;
+    uint32_t length = 0;
+    plist_to_bin(apps, &bin, &length);
+    plist_free(apps);
+
+    QDir().mkpath(GetDirectory(DIRECTORY_TYPE::LOCALDATA));
+    QSaveFile file(GetDirectory(DIRECTORY_TYPE::LOCALDATA) + "apps_" + session->GetUdid() + ".plist");
+    if (bin && file.open(QIODevice::WriteOnly))
+    {
+        file.write(bin, length);
+        file.commit();
+    }
+    free(bin);
+}
+
+void DeviceBridge::LoadInstalledApps(std::shared_ptr<DeviceSession> session)
+{
+    // switching back to a session that already browsed keeps its list
+    if (session->InstalledAppsRefreshed().isValid())
+    {
+        m_logHandler->UpdateInstalledList(session->GetInstalledApps());
+        return;
+    }
+
+    QMap<QString, PlistView> appList;
+    QFile file(GetDirectory(DIRECTORY_TYPE::LOCALDATA) + "apps_" + session->GetUdid() + ".plist");
+    if (file.open(QIODevice::ReadOnly))
+    {
+        QByteArray data = file.readAll();
+        plist_t apps = nullptr;
+        plist_from_bin(data.constData(), (uint32_t)data.size(), &apps);
+        appList = AppListFromArray(apps);
+        if (apps)
+            plist_free(apps);
+    }
+    session->SetInstalledApps(appList);
+    m_logHandler->UpdateInstalledList(appList);
+}
+
+void DeviceBridge::UpdateInstalledApp(std::shared_ptr<DeviceSession> session, QString bundleId, bool removed)
+{
+    if (bundleId.isEmpty())
+        return;
+
+    QMap<QString, PlistView> newAppList = session->GetInstalledApps();
+    if (removed)
+    {
+        newAppList.remove(bundleId);
+    }
+    else
+    {
+        PlistView app_info = GetAppInfo(bundleId, session);
+        if (!app_info.IsValid())
+            return;
+        newAppList[bundleId] = app_info;
+    }
+    UpdateInstalledApps(session, newAppList);
 }
 
 void DeviceBridge::UninstallApp(QString bundleId)
 {
     AsyncManager::Get()->StartAsyncRequest([this, bundleId]() {
-        if (!m_installer) {
+        auto session = GetSession();
+        auto installer = session ? session->AcquireService(SERVICE_INSTALLER) : nullptr;
+        if (!installer) {
             return;
         }
-        instproxy_uninstall(m_installer, bundleId.toUtf8().data(), NULL, InstallerCallback, NULL);
+        /* the status callback runs on instproxy's own thread, keep the client until it reports 100% */
+        QString operation = "Uninstall:" + bundleId;
+        session->AddInstallerLease(operation, installer);
+        if (instproxy_uninstall(session->Installer(), bundleId.toUtf8().data(), NULL, InstallerCallback, session.get()) != INSTPROXY_E_SUCCESS)
+            session->ReleaseInstallerLease(operation);
     });
 }
 
-void DeviceBridge::InstallApp(InstallerMode cmd, QString path)
+AsyncTask<bool> DeviceBridge::InstallApp(InstallerMode cmd, QString path)
 {
-    AsyncManager::Get()->StartAsyncRequest([this, cmd, path]() {
-        if (!m_installer) {
+    auto session = GetSession();
+    return AsyncManager::Get()->Run([this, session, cmd, path](const CancellationToken& token) {
+        auto installer = session ? session->AcquireService(SERVICE_INSTALLER) : nullptr;
+        auto afc = session ? session->AcquireService(SERVICE_AFC) : nullptr;
+        if (!installer || !afc) {
             emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, "", 100, "ERROR: instproxy_client_private is null!\nPlease connect your device to this PC!");
-            return;
+            return false;
         }
         char *bundleidentifier = NULL;
         QString pkgname = "";
+        // the final status only names the bundle when it was passed in the client options
+        QString timingKey, timings;
         uint64_t af = 0;
         char buf[8192];
 
         char **strs = NULL;
-        if (afc_get_file_info(m_afc, PKG_PATH, &strs) != AFC_E_SUCCESS) {
-            if (afc_make_directory(m_afc, PKG_PATH) != AFC_E_SUCCESS) {
+        if (afc_get_file_info(session->Afc(), PKG_PATH, &strs) != AFC_E_SUCCESS) {
+            if (afc_make_directory(session->Afc(), PKG_PATH) != AFC_E_SUCCESS) {
                 emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, "", 0, "WARNING: Could not create directory '" + QString(PKG_PATH) + "' on device!");
             }
         }
@@ -113,12 +259,12 @@ void DeviceBridge::InstallApp(InstallerMode cmd, QString path)
             struct zip *zf = zip_open(path.toUtf8().data(), 0, &errp);
             if (!zf) {
                 emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: zip_open: " + path + ": " + QString::number(errp));
-                return;
+                return false;
             }
 
             char* ipcc = path.toUtf8().data();
             pkgname = QString(PKG_PATH) + "/" + basename(ipcc);
-            afc_make_directory(m_afc, pkgname.toUtf8().data());
+            afc_make_directory(session->Afc(), pkgname.toUtf8().data());
 
             printf("Uploading %s package contents... ", basename(ipcc));
 
@@ -132,14 +278,14 @@ void DeviceBridge::InstallApp(InstallerMode cmd, QString path)
                 if (zname[strlen(zname)-1] == '/') {
                     // directory
                     dstpath = pkgname + "/" + zname;
-                    afc_make_directory(m_afc, dstpath.toUtf8().data());
+                    afc_make_directory(session->Afc(), dstpath.toUtf8().data());
                 } else {
                     // file
                     struct zip_file* zfile = zip_fopen_index(zf, i, 0);
                     if (!zfile) continue;
 
                     dstpath = pkgname + "/" + zname;
-                    if (afc_file_open(m_afc, dstpath.toUtf8().data(), AFC_FOPEN_WRONLY, &af) != AFC_E_SUCCESS) {
+                    if (afc_file_open(session->Afc(), dstpath.toUtf8().data(), AFC_FOPEN_WRONLY, &af) != AFC_E_SUCCESS) {
                         emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Can't open afc://" + dstpath + " for writing.");
                         zip_fclose(zfile);
                         continue;
@@ -164,7 +310,7 @@ void DeviceBridge::InstallApp(InstallerMode cmd, QString path)
                             uint32_t written, total = 0;
                             while (total < amount) {
                                 written = 0;
-                                if (afc_file_write(m_afc, af, buf, amount, &written) != AFC_E_SUCCESS) {
+                                if (afc_file_write(session->Afc(), af, buf, amount, &written) != AFC_E_SUCCESS) {
                                     emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: AFC Write error!");
                                     break;
                                 }
@@ -172,16 +318,16 @@ void DeviceBridge::InstallApp(InstallerMode cmd, QString path)
                             }
                             if (total != amount) {
                                 emit MessagesReceived(MessagesType::MSG_ERROR, "ERROR: Wrote only " + QString::number(total) + " of " + QString::number(amount));
-                                afc_file_close(m_afc, af);
+                                afc_file_close(session->Afc(), af);
                                 zip_fclose(zfile);
-                                return;
+                                return false;
                             }
                         }
 
                         zfsize += amount;
                     }
 
-                    afc_file_close(m_afc, af);
+                    afc_file_close(session->Afc(), af);
                     af = 0;
 
                     zip_fclose(zfile);
@@ -208,7 +354,7 @@ void DeviceBridge::InstallApp(InstallerMode cmd, QString path)
             if (!jvInfo.readPListFile(filename.toUtf8().data()))
             {
                 emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, "", 100, "ERROR: Could not read " + filename);
-                return;
+                return false;
             }
             bundleidentifier = strdup(jvInfo["CFBundleIdentifier"].asCString());
 
@@ -218,77 +364,289 @@ void DeviceBridge::InstallApp(InstallerMode cmd, QString path)
                 int percentage = int((float(progress) / (float(total) * 2.f)) * 100.f);
                 emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, bundleidentifier, percentage, QString::asprintf("(%d/%d) ", progress, total) + messages);
             };
-            if (!afc_upload_dir(m_afc, path, pkgname, afc_callback))
+            AfcTransferStats stats;
+            bool delta = UserConfigs::Get()->GetData("DeltaInstall", true);
+            bool network = session->GetConnectionType() == CONNECTION_NETWORK;
+            if (!(delta ? afc_sync_dir(session->Afc(), session->GetUdid(), path, pkgname, network, afc_callback, &stats) : afc_upload_dir(session->Afc(), path, pkgname, network, afc_callback, &stats)))
             {
                 emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, "", 100, "ERROR: Could not send " + path);
-                return;
+                return false;
             }
+            emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, bundleidentifier, 50, QString("Sent %1 files, ").arg(stats.files) + afc_throughput(stats));
             instproxy_client_options_add(client_opts, "PackageType", "Developer", NULL);
         }
         else
         {
-            /* determine .app directory in archive */
-            QString app_directory_name;
-            if (!ZipGetAppDirectory(path, app_directory_name)) {
-                emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, "", 100, "ERROR: Unable to locate app directory in archive!");
-                return;
-            }
+            /* copy archive to device while its metadata is checked, nothing in the upload depends on it */
+            QElapsedTimer phase;
+            phase.start();
+            pkgname = QString(PKG_PATH) + "/" + QFileInfo(path).fileName();
+            emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, "", 0, "Sending " + QFileInfo(path).fileName());
+            auto callback = [this](uint64_t uploaded_bytes, uint64_t total_bytes)
+            {
+                int percentage = int((float(uploaded_bytes) / (float(total_bytes) * 2.f)) * 100.f);
+                QString message = "Sending " + BytesToString(uploaded_bytes) + " of " + BytesToString(total_bytes);
+                emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, "", percentage, message);
+            };
+            AfcTransferStats stats;
+            std::future<int> upload = std::async(std::launch::async, [this, session, path, pkgname, callback, &stats]() {
+                return afc_upload_file(session->Afc(), path, pkgname, session->GetConnectionType() == CONNECTION_NETWORK, callback, &stats);
+            });
 
-            /* construct full filename to Info.plist */
-            QString filename = app_directory_name + "\\Info.plist";
+            /* determine .app directory and Info.plist in a single pass over the archive */
+            QString app_directory_name;
             std::vector<char> info;
-            if (!ZipGetContents(path, filename, info)) {
-                emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, "", 100, "ERROR: Could not locate " + filename + " in archive!");
-                return;
+            QString error;
+            JValue jvInfo;
+            if (!ZipGetAppInfo(path, app_directory_name, info)) {
+                error = app_directory_name.isEmpty() ? "ERROR: Unable to locate app directory in archive!" : "ERROR: Could not locate " + app_directory_name + "/Info.plist in archive!";
+            } else if (!jvInfo.readPList(&info[0], info.size())) {
+                error = "ERROR: Could not parse Info.plist!";
+            } else if (!jvInfo.has("CFBundleExecutable")) {
+                error = "ERROR: Could not determine value for CFBundleExecutable!";
             }
+            qint64 metadata_msecs = phase.elapsed();
 
-            JValue jvInfo;
-            if (!jvInfo.readPList(&info[0], info.size()))
-            {
-                emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, "", 100, "ERROR: Could not parse Info.plist!");
-                return;
+            int result = upload.get();
+            if (!error.isEmpty()) {
+                afc_remove_path(session->Afc(), pkgname.toUtf8().data());
+                emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, "", 100, error);
+                return false;
             }
             bundleidentifier = strdup(jvInfo["CFBundleIdentifier"].asCString());
-            if (!jvInfo.has("CFBundleExecutable")) {
-                emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, "", 100, "ERROR: Could not determine value for CFBundleExecutable!");
-                return;
-            }
-
-            /* copy archive to device */
-            pkgname = QString(PKG_PATH) + "/" + bundleidentifier;
-            emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, bundleidentifier, 0, "Sending " + QFileInfo(path).fileName());
-            auto callback = [&](uint32_t uploaded_bytes, uint32_t total_bytes)
-            {
-                int percentage = int((float(uploaded_bytes) / (float(total_bytes) * 2.f)) * 100.f);
-                QString message = "Sending " + BytesToString(uploaded_bytes) + " of " + BytesToString(total_bytes);
-                emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, bundleidentifier, percentage, message);
-            };
-            int result = afc_upload_file(m_afc, path, pkgname, callback);
             if (result != 0) {
                 emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, bundleidentifier, 100, QString::asprintf("ERROR: Failed to send %s : afc error code %d", path.toUtf8().data(), result));
-                return;
+                return false;
             }
+            emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, bundleidentifier, 50, "Sent " + afc_throughput(stats));
+            timings = QString("metadata %1 ms, upload %2 ms").arg(metadata_msecs).arg(stats.msecs);
 
             if (bundleidentifier) {
                 instproxy_client_options_add(client_opts, "CFBundleIdentifier", bundleidentifier, NULL);
+                timingKey = bundleidentifier;
             }
         }
 
+        if (token.IsCancelled()) {
+            instproxy_client_options_free(client_opts);
+            emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, bundleidentifier, 100, "ERROR: Device disconnected, installation cancelled!");
+            return false;
+        }
+
         /* perform installation or upgrade */
+        session->StartInstallTimer(timingKey, timings);
+        QString operation = QString(cmd == CMD_INSTALL ? "Install:" : "Upgrade:") + timingKey;
+        session->AddInstallerLease(operation, installer);
+        instproxy_error_t err = INSTPROXY_E_UNKNOWN_ERROR;
         if (cmd == CMD_INSTALL) {
             emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, bundleidentifier, 51, "Installing " + QString(bundleidentifier));
-            instproxy_install(m_installer, pkgname.toUtf8().data(), client_opts, InstallerCallback, NULL);
+            err = instproxy_install(session->Installer(), pkgname.toUtf8().data(), client_opts, InstallerCallback, session.get());
         } else {
             emit InstallerStatusChanged(InstallerMode::CMD_INSTALL, bundleidentifier, 51, "Upgrading " + QString(bundleidentifier));
-            instproxy_upgrade(m_installer, pkgname.toUtf8().data(), client_opts, InstallerCallback, NULL);
+            err = instproxy_upgrade(session->Installer(), pkgname.toUtf8().data(), client_opts, InstallerCallback, session.get());
         }
+        if (err != INSTPROXY_E_SUCCESS)
+            session->ReleaseInstallerLease(operation);
         instproxy_client_options_free(client_opts);
-    });
+        return err == INSTPROXY_E_SUCCESS;
+    }, TASK_BULK, session ? session->Token() : CancellationToken());
+}
+
+void DeviceBridge::InstallApps(InstallerMode cmd, QStringList udids, QStringList packages, int perDevice)
+{
+    auto batch = std::make_shared<InstallBatch>();
+    batch->cmd = cmd;
+    QMap<QString, idevice_connection_type> devices = AttachedDevices();
+    foreach (const QString& udid, udids)
+    {
+        batch->connections[udid] = devices.value(udid, CONNECTION_USBMUXD);
+        foreach (const QString& package, packages)
+            batch->pending << qMakePair(udid, QFileInfo(package).absoluteFilePath());
+    }
+    batch->perDevice = qMax(1, perDevice);
+    batch->total = batch->pending.count();
+    batch->elapsed.start();
+    if (batch->total == 0)
+    {
+        emit InstallBatchFinished(0, 0, 0);
+        return;
+    }
+
+    // every job owns its device connection, the shared pool stays free for the UI requests
+    if (!m_installPool)
+        m_installPool = new AsyncManager(qMax(2u, std::thread::hardware_concurrency()));
+    DispatchInstallBatch(batch);
+}
+
+void DeviceBridge::DispatchInstallBatch(std::shared_ptr<InstallBatch> batch)
+{
+    QMutexLocker locker(&batch->mutex);
+    for (int idx = 0; idx < batch->pending.count();)
+    {
+        auto job = batch->pending[idx];
+        QString key = job.first + "|" + job.second;
+        if (batch->running.value(job.first) >= batch->perDevice || batch->runningJobs.contains(key))
+        {
+            idx++;
+            continue;
+        }
+        batch->pending.removeAt(idx);
+        batch->running[job.first]++;
+        batch->runningJobs.insert(key);
+
+        m_installPool->StartAsyncRequest([this, batch, job, key]() {
+            QString message;
+            qint64 upload_msecs = 0, install_msecs = 0;
+            bool success = InstallBatchJob(batch->cmd, job.first, batch->connections.value(job.first), job.second, message, upload_msecs, install_msecs);
+            emit InstallJobFinished(job.first, job.second, success, message, upload_msecs, install_msecs);
+
+            bool finished = false;
+            {
+                QMutexLocker locker(&batch->mutex);
+                batch->running[job.first]--;
+                batch->runningJobs.remove(key);
+                batch->done++;
+                if (!success)
+                    batch->failed++;
+                finished = batch->done == batch->total;
+                emit InstallBatchProgress(batch->done, batch->total, batch->failed);
+            }
+            if (finished)
+                emit InstallBatchFinished(batch->total - batch->failed, batch->failed, batch->elapsed.elapsed());
+            else
+                DispatchInstallBatch(batch);
+        });
+    }
 }
 
-void DeviceBridge::TriggetInstallerStatus(QJsonDocument command, QJsonDocument status)
+bool DeviceBridge::InstallBatchJob(InstallerMode cmd, const QString &udid, idevice_connection_type type, const QString &package, QString &message, qint64 &upload_msecs, qint64 &install_msecs)
 {
-    InstallerMode pCommand = command["Command"].toString() == "Install" ? InstallerMode::CMD_INSTALL : InstallerMode::CMD_UNINSTALL;
+    QString app_directory_name;
+    std::vector<char> info;
+    JValue jvInfo;
+    if (!ZipGetAppInfo(package, app_directory_name, info) || !jvInfo.readPList(&info[0], info.size()) || !jvInfo.has("CFBundleIdentifier"))
+    {
+        message = "ERROR: Could not read Info.plist from " + package;
+        return false;
+    }
+    QString bundleidentifier = jvInfo["CFBundleIdentifier"].asCString();
+
+    idevice_t device = nullptr;
+    lockdownd_client_t client = nullptr;
+    afc_client_t afc = nullptr;
+    instproxy_client_t installer = nullptr;
+    auto cleanup = [&]() {
+        if (installer) instproxy_client_free(installer);
+        if (afc) afc_client_free(afc);
+        if (client) lockdownd_client_free(client);
+        if (device) idevice_free(device);
+    };
+
+    idevice_new_with_options(&device, udid.toUtf8().data(), type == CONNECTION_USBMUXD ? IDEVICE_LOOKUP_USBMUX : IDEVICE_LOOKUP_NETWORK);
+    if (!device || lockdownd_client_new_with_handshake(device, &client, TOOL_NAME) != LOCKDOWN_E_SUCCESS)
+    {
+        message = "ERROR: Connecting to " + udid + " failed!";
+        cleanup();
+        return false;
+    }
+
+    lockdownd_service_descriptor_t service = nullptr;
+    if (lockdownd_start_service(client, "com.apple.afc", &service) == LOCKDOWN_E_SUCCESS)
+        afc_client_new(device, service, &afc);
+    lockdownd_service_descriptor_free(service);
+    service = nullptr;
+    if (lockdownd_start_service(client, "com.apple.mobile.installation_proxy", &service) == LOCKDOWN_E_SUCCESS)
+        instproxy_client_new(device, service, &installer);
+    lockdownd_service_descriptor_free(service);
+    if (!afc || !installer)
+    {
+        message = "ERROR: Could not start afc or installation proxy on " + udid;
+        cleanup();
+        return false;
+    }
+
+    /* reuse the archive staged by an earlier job when the device still holds the same bytes */
+    // packages with the same file name from different folders must not share a staged archive
+    QFileInfo package_info(package);
+    QString staged_name = QCryptographicHash::hash(package_info.absoluteFilePath().toUtf8(), QCryptographicHash::Md5).toHex().left(12) + "_" + package_info.fileName();
+    QString pkgname = QString(PKG_PATH) + "/" + staged_name;
+    bool staged = false;
+    {
+        QMutexLocker locker(&m_stagedMutex);
+        QJsonObject known = m_stagedArchives[udid].value(staged_name);
+        staged = known["size"].toInteger() == package_info.size()
+              && known["mtime"].toInteger() == package_info.lastModified().toMSecsSinceEpoch();
+    }
+    if (staged)
+    {
+        char **fileinfo = NULL;
+        qint64 remote_size = -1;
+        if (afc_get_file_info(afc, pkgname.toUtf8().data(), &fileinfo) == AFC_E_SUCCESS && fileinfo)
+        {
+            for (int i = 0; fileinfo[i]; i += 2)
+            {
+                if (!strcmp(fileinfo[i], "st_size"))
+                    remote_size = atoll(fileinfo[i+1]);
+            }
+        }
+        if (fileinfo)
+            afc_dictionary_free(fileinfo);
+        staged = remote_size == package_info.size();
+    }
+
+    QElapsedTimer phase;
+    phase.start();
+    if (!staged)
+    {
+        afc_make_directory(afc, PKG_PATH);
+        int result = afc_upload_file(afc, package, pkgname, type == CONNECTION_NETWORK);
+        if (result != 0)
+        {
+            message = QString::asprintf("ERROR: Failed to send %s : afc error code %d", package.toUtf8().data(), result);
+            cleanup();
+            return false;
+        }
+        QJsonObject known;
+        known["size"] = package_info.size();
+        known["mtime"] = package_info.lastModified().toMSecsSinceEpoch();
+        QMutexLocker locker(&m_stagedMutex);
+        m_stagedArchives[udid][staged_name] = known;
+    }
+    upload_msecs = phase.restart();
+
+    /* without a status callback instproxy blocks until installd is done */
+    plist_t client_opts = instproxy_client_options_new();
+    instproxy_client_options_add(client_opts, "CFBundleIdentifier", bundleidentifier.toUtf8().data(), NULL);
+    instproxy_error_t err = cmd == CMD_INSTALL ? instproxy_install(installer, pkgname.toUtf8().data(), client_opts, NULL, NULL)
+                                               : instproxy_upgrade(installer, pkgname.toUtf8().data(), client_opts, NULL, NULL);
+    instproxy_client_options_free(client_opts);
+    install_msecs = phase.elapsed();
+    cleanup();
+
+    if (err != INSTPROXY_E_SUCCESS)
+    {
+        message = (cmd == CMD_INSTALL ? "ERROR: Installing " : "ERROR: Upgrading ") + bundleidentifier + " failed! " + QString::number(err);
+        return false;
+    }
+    message = QString("%1 %2%3, upload %4 ms, install %5 ms").arg(cmd == CMD_INSTALL ? "Installed" : "Upgraded", bundleidentifier, staged ? " (reused staged archive)" : "").arg(upload_msecs).arg(install_msecs);
+    return true;
+}
+
+void DeviceBridge::TriggetInstallerStatus(QJsonDocument command, QJsonDocument status, DeviceSession* source)
+{
+    std::shared_ptr<DeviceSession> session;
+    {
+        QMutexLocker locker(&m_sessionsMutex);
+        foreach (const auto& item, m_sessions)
+        {
+            if (item.get() == source)
+                session = item;
+        }
+    }
+
+    // an upgrade reports as "Upgrade" and is shown like an install
+    QString pOperation = command["Command"].toString();
+    InstallerMode pCommand = pOperation == "Uninstall" ? InstallerMode::CMD_UNINSTALL : InstallerMode::CMD_INSTALL;
     QString pBundleId = pCommand == InstallerMode::CMD_INSTALL ? command["ClientOptions"]["CFBundleIdentifier"].toString() : command["ApplicationIdentifier"].toString();
 
     int percentage = 0;
@@ -306,14 +664,26 @@ void DeviceBridge::TriggetInstallerStatus(QJsonDocument command, QJsonDocument s
     {
         percentage = pMessage == "Complete" ? 100 : (50 + status["PercentComplete"].toInt() / 2);
     }
+    if (percentage == 100 && pCommand == InstallerMode::CMD_INSTALL && session) {
+        QString timings = session->TakeInstallTimings(pBundleId);
+        if (!timings.isEmpty())
+            pMessage += "\n" + timings;
+    }
     emit InstallerStatusChanged(pCommand, pBundleId, percentage, pMessage);
-    if (percentage == 100) {
-        ConnectToDevice(m_currentUdid);
+    if (!session)
+        return;
+    if (percentage == 100)
+        session->ReleaseInstallerLease(pOperation + ":" + pBundleId);
+    if (percentage == 100 && status["Status"].toString() == "Complete") {
+        /* instproxy still holds its client lock inside this callback, look the app up afterwards */
+        AsyncManager::Get()->StartAsyncRequest([this, session, pBundleId, pCommand]() {
+            UpdateInstalledApp(session, pBundleId, pCommand == InstallerMode::CMD_UNINSTALL);
+        }, TASK_BACKGROUND);
     }
 }
 
-void DeviceBridge::InstallerCallback(plist_t command, plist_t status, void *unused)
+void DeviceBridge::InstallerCallback(plist_t command, plist_t status, void *user_data)
 {
     if (!m_destroyed)
-        DeviceBridge::Get()->TriggetInstallerStatus(PlistToJson(command), PlistToJson(status));
+        DeviceBridge::Get()->TriggetInstallerStatus(PlistToJson(command), PlistToJson(status), (DeviceSession*)user_data);
 }
@@ -5,14 +5,80 @@
 #include "nskeyedarchiver/kaarray.hpp"
 #include <QJsonDocument>
 #include <QJsonArray>
+#include <QDateTime>
+#include <cmath>
 
 using namespace idevice;
 
+static double SampleValue(const nskeyedarchiver::KAValue& value)
+{
+    if (value.IsInteger())
+        return (double)value.ToInteger();
+    if (value.IsDouble())
+        return value.ToDouble();
+    if (value.IsBool())
+        return value.ToBool() ? 1.0 : 0.0;
+    return std::nan("");
+}
+
+// sysmontap sends an array of dictionaries, "System" is an array and "Processes" maps pid to an array,
+// both in the configured attribute order
+static bool DecodeSysmontap(const nskeyedarchiver::KAValue& payload, const QStringList& process_attr, PerfSample& sample)
+{
+    if (!payload.IsObject())
+        return false;
+
+    int name_column = process_attr.indexOf("name");
+    int pid_column = process_attr.indexOf("pid");
+    const auto& entries = payload.ToObject<nskeyedarchiver::KAArray>();
+    for (size_t idx = 0; idx < entries.size(); idx++)
+    {
+        if (!entries.at(idx).IsObject())
+            continue;
+        const auto& entry = entries.at(idx).ToObject<nskeyedarchiver::KAMap>();
+
+        auto system = entry.find("System");
+        if (system != entry.end() && system->second.IsObject())
+        {
+            const auto& values = system->second.ToObject<nskeyedarchiver::KAArray>();
+            sample.system.resize(values.size());
+            for (size_t col = 0; col < values.size(); col++)
+                sample.system[col] = SampleValue(values.at(col));
+        }
+
+        auto processes = entry.find("Processes");
+        if (processes == entry.end() || !processes->second.IsObject())
+            continue;
+        const auto& process_map = processes->second.ToObject<nskeyedarchiver::KAMap>();
+        sample.processes.reserve(sample.processes.size() + process_map.size());
+        for (const auto& process : process_map)
+        {
+            if (!process.second.IsObject())
+                continue;
+            const auto& values = process.second.ToObject<nskeyedarchiver::KAArray>();
+            ProcessSample process_sample;
+            process_sample.pid = QString::fromStdString(process.first).toLongLong();
+            process_sample.values.resize(values.size());
+            for (size_t col = 0; col < values.size(); col++)
+                process_sample.values[col] = SampleValue(values.at(col));
+            if (name_column >= 0 && name_column < (int)values.size() && values.at(name_column).IsStr())
+                process_sample.name = QString::fromUtf8(values.at(name_column).ToStr());
+            if (pid_column >= 0 && pid_column < (int)values.size() && values.at(pid_column).IsInteger())
+                process_sample.pid = (qint64)values.at(pid_column).ToInteger();
+            sample.processes.push_back(std::move(process_sample));
+        }
+    }
+    return !sample.system.empty() || !sample.processes.empty();
+}
+
 QStringList DeviceBridge::GetAttributes(AttrType type)
 {
     QStringList list;
     if (!m_connection) {
-        m_transport = new DTXTransport(m_device);
+        auto session = GetSession();
+        if (!session)
+            return list;
+        m_transport = new DTXTransport(session->Device());
         m_connection = new DTXConnection(m_transport);
         m_connection->Connect();
     }
@@ -33,7 +99,10 @@ QStringList DeviceBridge::GetAttributes(AttrType type)
 void DeviceBridge::StartMonitor(unsigned int interval_ms, QStringList system_attr, QStringList process_attr)
 {
     if (!m_connection) {
-        m_transport = new DTXTransport(m_device);
+        auto session = GetSession();
+        if (!session)
+            return;
+        m_transport = new DTXTransport(session->Device());
         m_connection = new DTXConnection(m_transport);
         m_connection->Connect();
     }
@@ -60,9 +129,23 @@ void DeviceBridge::StartMonitor(unsigned int interval_ms, QStringList system_att
     auto response = m_sysmontapChannel->SendMessageSync(message);
     response->Dump();
 
-    m_sysmontapChannel->SetMessageHandler([=](std::shared_ptr<DTXMessage> msg) {
-        if (msg->PayloadObject()) {
-            qDebug() << msg->PayloadObject()->ToJson().c_str();
+    // keep the last PERF_WINDOW_MS of samples for the live view, the whole run goes to the device store
+    std::shared_ptr<PerfMetrics> metrics = std::make_shared<PerfMetrics>(system_attr, process_attr, PERF_WINDOW_MS / qMax(1u, interval_ms));
+    std::shared_ptr<PerfStore> store = GetPerfStore(GetCurrentUdid(), true);
+    {
+        QMutexLocker locker(&m_perfMutex);
+        m_perfMetrics = metrics;
+    }
+    m_sysmontapChannel->SetMessageHandler([this, metrics, store, system_attr, process_attr](std::shared_ptr<DTXMessage> msg) {
+        if (!msg->PayloadObject())
+            return;
+        PerfSample sample;
+        sample.timestamp = QDateTime::currentMSecsSinceEpoch();
+        if (DecodeSysmontap(*msg->PayloadObject(), process_attr, sample)) {
+            metrics->Append(sample);
+            if (store)
+                store->Append(sample, system_attr, process_attr);
+            emit MonitorSampled(sample.timestamp);
         }
     });
 
@@ -80,10 +163,41 @@ void DeviceBridge::StopMonitor()
     }
 }
 
+std::shared_ptr<PerfMetrics> DeviceBridge::GetMonitorMetrics()
+{
+    QMutexLocker locker(&m_perfMutex);
+    return m_perfMetrics;
+}
+
+std::shared_ptr<PerfStore> DeviceBridge::GetPerfStore(QString udid, bool create)
+{
+    if (udid.isEmpty())
+        udid = GetCurrentUdid();
+    if (udid.isEmpty())
+        return nullptr;
+
+    QMutexLocker locker(&m_perfMutex);
+    std::shared_ptr<PerfStore> store = m_perfStores.value(udid);
+    if (!store && create) {
+        store = std::make_shared<PerfStore>(udid);
+        m_perfStores.insert(udid, store);
+    }
+    return store;
+}
+
+bool DeviceBridge::ExportMonitorMetrics(QString path)
+{
+    std::shared_ptr<PerfMetrics> metrics = GetMonitorMetrics();
+    return metrics && metrics->ExportCsv(path);
+}
+
 void DeviceBridge::GetProcessList()
 {
     if (!m_connection) {
-        m_transport = new DTXTransport(m_device);
+        auto session = GetSession();
+        if (!session)
+            return;
+        m_transport = new DTXTransport(session->Device());
         m_connection = new DTXConnection(m_transport);
         m_connection->Connect();
     }
@@ -100,7 +214,10 @@ void DeviceBridge::GetProcessList()
 void DeviceBridge::StartFPS(unsigned int interval_ms)
 {
     if (!m_connection) {
-        m_transport = new DTXTransport(m_device);
+        auto session = GetSession();
+        if (!session)
+            return;
+        m_transport = new DTXTransport(session->Device());
         m_connection = new DTXConnection(m_transport);
         m_connection->Connect();
     }
@@ -116,10 +233,25 @@ void DeviceBridge::StartFPS(unsigned int interval_ms)
     message->AppendAuxiliary(nskeyedarchiver::KAValue((float)interval_ms / 100.f));
     m_openglChannel->SendMessageSync(message);
 
-    m_openglChannel->SetMessageHandler([=](std::shared_ptr<DTXMessage> msg) {
-        if (msg->PayloadObject()) {
-            qDebug() << msg->PayloadObject()->ToJson().c_str();
+    // the statistics dictionary keys of the first sample become the "Graphics" columns
+    std::shared_ptr<PerfStore> store = GetPerfStore(GetCurrentUdid(), true);
+    QStringList columns;
+    m_openglChannel->SetMessageHandler([store, columns](std::shared_ptr<DTXMessage> msg) mutable {
+        if (!store || !msg->PayloadObject() || !msg->PayloadObject()->IsObject())
+            return;
+        const auto& statistics = msg->PayloadObject()->ToObject<nskeyedarchiver::KAMap>();
+        if (columns.isEmpty()) {
+            for (const auto& item : statistics)
+                columns.append(QString::fromStdString(item.first));
+            columns.sort();
+        }
+        std::vector<double> values(columns.size(), std::nan(""));
+        for (const auto& item : statistics) {
+            int column = columns.indexOf(QString::fromStdString(item.first));
+            if (column >= 0)
+                values[column] = SampleValue(item.second);
         }
+        store->Append("Graphics", columns, QDateTime::currentMSecsSinceEpoch(), values);
     });
 
     message = DTXMessage::CreateWithSelector("startSamplingAtTimeInterval:");
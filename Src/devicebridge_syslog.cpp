@@ -76,7 +76,7 @@ void DeviceBridge::ClearCachedLogs()
     m_logHandler->ClearCachedLogs();
 }
 
-QStringList DeviceBridge::GetPIDOptions(QMap<QString, QJsonDocument>& installed_apps)
+QStringList DeviceBridge::GetPIDOptions(QMap<QString, PlistView>& installed_apps)
 {
     QStringList result = QStringList() << "By user apps only" << "Related to user apps";
     foreach (auto appinfo, installed_apps)
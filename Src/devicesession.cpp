@@ -0,0 +1,520 @@
+#include "devicesession.h"
+#include "devicebridge.h"
+#include <QDebug>
+
+DeviceSession::DeviceSession(const QString &udid, idevice_connection_type type, const std::function<void (const QString &)> &error_handler)
+    : m_udid(udid)
+    , m_connectionType(type)
+    , m_errorHandler(error_handler)
+    , m_device(nullptr)
+    , m_client(nullptr)
+    , m_installer(nullptr)
+    , m_afc(nullptr)
+    , m_crashlog(nullptr)
+    , m_afcPoolOpen(0)
+    , m_imageMounter(nullptr)
+    , m_screenshot(nullptr)
+    , m_syslog(nullptr)
+    , m_syslogCapturing(false)
+{
+}
+
+DeviceSession::~DeviceSession()
+{
+    Close();
+}
+
+bool DeviceSession::Connect(QStringList &timings_out)
+{
+    QElapsedTimer timer;
+    timer.start();
+    idevice_new_with_options(&m_device, m_udid.toStdString().c_str(), m_connectionType == CONNECTION_USBMUXD ? IDEVICE_LOOKUP_USBMUX : IDEVICE_LOOKUP_NETWORK);
+    if (!m_device) {
+        m_errorHandler("ERROR: No device with UDID " + m_udid);
+        return false;
+    }
+    timings_out << QString("device %1 ms").arg(timer.restart());
+
+    if (LOCKDOWN_E_SUCCESS != lockdownd_client_new_with_handshake(m_device, &m_client, TOOL_NAME)) {
+        idevice_free(m_device);
+        m_device = nullptr;
+        m_client = nullptr;
+        m_errorHandler("ERROR: Connecting to " + m_udid + " failed!");
+        return false;
+    }
+    timings_out << QString("handshake %1 ms").arg(timer.restart());
+
+    plist_t node = nullptr;
+    if (lockdownd_get_value(m_client, nullptr, nullptr, &node) != LOCKDOWN_E_SUCCESS || !node) {
+        m_errorHandler("ERROR: Could not read device info from " + m_udid);
+        return false;
+    }
+    // keys are converted on first access, only the info dialog needs the whole tree
+    m_deviceInfo = PlistView(node);
+    timings_out << QString("device info %1 ms").arg(timer.restart());
+
+    // everything else is opened by AcquireService when a feature first needs it
+    QStringList serviceIds = QStringList() << SYSLOG_RELAY_SERVICE_NAME;
+    StartLockdown(!m_syslog, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
+        syslog_relay_error_t err = syslog_relay_client_new(m_device, service, &m_syslog);
+        if (err != SYSLOG_RELAY_E_SUCCESS)
+            m_errorHandler("ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
+    });
+    timings_out << QString("syslog relay %1 ms").arg(timer.elapsed());
+    return true;
+}
+
+void DeviceSession::Close(bool hangup)
+{
+    Shutdown(hangup, false);
+}
+
+bool DeviceSession::CloseIfIdle()
+{
+    return Shutdown(true, true);
+}
+
+bool DeviceSession::Shutdown(bool hangup, bool only_idle)
+{
+    // every service is held at once, no holder can appear between the check and the close
+    for (int type = 0; type < SERVICE_COUNT; type++)
+        m_services[type].mutex.lock();
+
+    bool idle = true;
+    for (int type = 0; type < SERVICE_COUNT; type++)
+        idle = idle && m_services[type].users == 0;
+
+    bool close = idle || !only_idle;
+    if (close)
+    {
+        m_token.Cancel();
+        StopSyslog();
+        for (int type = 0; type < SERVICE_COUNT; type++)
+            FreeService((ServiceType)type, hangup);
+
+        if (m_syslog)
+        {
+            syslog_relay_client_free(m_syslog);
+            m_syslog = nullptr;
+        }
+
+        // a failed handshake already released the device in Connect, so both handles are ours to free here
+        // without a client, a caller waiting in AcquireService cannot reopen anything
+        QMutexLocker locker(&m_lockdownMutex);
+        if (m_client)
+        {
+            lockdownd_client_free(m_client);
+            m_client = nullptr;
+        }
+
+        if (m_device)
+        {
+            idevice_free(m_device);
+            m_device = nullptr;
+        }
+    }
+
+    for (int type = SERVICE_COUNT - 1; type >= 0; type--)
+        m_services[type].mutex.unlock();
+
+    // a lease releases under its service mutex, so they only go once that is unlocked
+    if (close)
+    {
+        QMultiMap<QString, std::shared_ptr<void>> leases;
+        QMutexLocker locker(&m_installerLeasesMutex);
+        leases.swap(m_installerLeases);
+        locker.unlock();
+    }
+    return close;
+}
+
+bool DeviceSession::IsConnected()
+{
+    QMutexLocker locker(&m_lockdownMutex);
+    return m_client != nullptr;
+}
+
+bool DeviceSession::IsAlive()
+{
+    // cheapest lockdown round trip, fails once the device went away or re-enumerated
+    QMutexLocker locker(&m_lockdownMutex);
+    if (!m_client)
+        return false;
+    return lockdownd_query_type(m_client, nullptr) == LOCKDOWN_E_SUCCESS;
+}
+
+void DeviceSession::SetActive(bool active)
+{
+    if (active)
+    {
+        m_inactive.invalidate();
+        return;
+    }
+
+    m_inactive.start();
+    StopSyslog();
+    // the lockdown client, installer and afc make switching back instant, the rest is reopened on demand
+    const ServiceType expensive[] = { SERVICE_CRASHLOG, SERVICE_IMAGE_MOUNTER, SERVICE_SCREENSHOT };
+    for (ServiceType type : expensive)
+    {
+        ServiceState& state = m_services[type];
+        QMutexLocker locker(&state.mutex);
+        if (state.users == 0)
+            FreeService(type);
+    }
+}
+
+qint64 DeviceSession::InactiveMsecs()
+{
+    return m_inactive.isValid() ? m_inactive.elapsed() : 0;
+}
+
+void DeviceSession::StartLockdown(bool condition, QStringList service_ids, const std::function<void (QString &, lockdownd_service_descriptor_t &)> &function)
+{
+    if (!condition)
+        return;
+
+    lockdownd_error_t lerr = lockdownd_error_t::LOCKDOWN_E_UNKNOWN_ERROR;
+    lockdownd_service_descriptor_t service = nullptr;
+    QString service_id;
+    // the lockdown connection is shared by every service of this device, one request at a time
+    m_lockdownMutex.lock();
+    if (!m_client)
+    {
+        m_lockdownMutex.unlock();
+        return;
+    }
+    for ( const auto& svc_id : service_ids)
+    {
+        service_id = svc_id;
+        lerr = lockdownd_start_service(m_client, svc_id.toUtf8().data(), &service);
+        if(lerr == LOCKDOWN_E_SUCCESS) { break; }
+    }
+    m_lockdownMutex.unlock();
+
+    switch (lerr)
+    {
+        case LOCKDOWN_E_SUCCESS:
+            function(service_id, service);
+            lockdownd_service_descriptor_free(service);
+            break;
+
+        case LOCKDOWN_E_PASSWORD_PROTECTED:
+            m_errorHandler("ERROR: Device is passcode protected, enter passcode on the device to continue.");
+            break;
+
+        default:
+            m_errorHandler("ERROR: Could not connect to " + service_id + " lockdownd: " + QString::number(lerr));
+            break;
+    }
+}
+
+std::shared_ptr<void> DeviceSession::AcquireService(ServiceType type)
+{
+    if (!IsConnected())
+        return nullptr;
+
+    ServiceState* state = &m_services[type];
+    QMutexLocker locker(&state->mutex);
+    if (!IsServiceOpen(type))
+        OpenService(type);
+    if (!IsServiceOpen(type))
+        return nullptr;
+
+    state->users++;
+    state->used.start();
+    return std::shared_ptr<void>(state, [](void* ptr) {
+        ServiceState* state = (ServiceState*)ptr;
+        QMutexLocker locker(&state->mutex);
+        state->users--;
+        state->used.start();
+    });
+}
+
+void DeviceSession::OpenService(ServiceType type)
+{
+    QStringList serviceIds;
+    switch (type)
+    {
+    case SERVICE_INSTALLER:
+        serviceIds << "com.apple.mobile.installation_proxy";
+        StartLockdown(true, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
+            instproxy_error_t err = instproxy_client_new(m_device, service, &m_installer);
+            if (err != INSTPROXY_E_SUCCESS)
+                m_errorHandler("ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
+        });
+        break;
+
+    case SERVICE_AFC:
+        serviceIds << "com.apple.afc";
+        StartLockdown(true, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
+            afc_error_t err = afc_client_new(m_device, service, &m_afc);
+            if (err != AFC_E_SUCCESS)
+                m_errorHandler("ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
+        });
+        break;
+
+    case SERVICE_CRASHLOG:
+        // the mover hands the reports over to the copy service, only a crashlog sync pays for its ping wait
+        serviceIds << "com.apple.crashreportmover";
+        StartLockdown(true, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
+            service_client_t svcmove = NULL;
+            service_error_t err = service_client_new(m_device, service, &svcmove);
+            if (err != SERVICE_E_SUCCESS)
+            {
+                m_errorHandler("ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
+                return;
+            }
+
+            /* read "ping" message which indicates the crash logs have been moved to a safe harbor */
+            char* ping = (char*)malloc(4);
+            memset(ping, '\0', 4);
+            int attempts = 0;
+            while ((strncmp(ping, "ping", 4) != 0) && (attempts < 10)) {
+                uint32_t bytes = 0;
+                err = service_receive_with_timeout(svcmove, ping, 4, &bytes, 2000);
+                if (err == SERVICE_E_SUCCESS || err == SERVICE_E_TIMEOUT) {
+                    attempts++;
+                    continue;
+                }
+
+                fprintf(stderr, "ERROR: Crash logs could not be moved. Connection interrupted (%d).\n", err);
+                break;
+            }
+            service_client_free(svcmove);
+            free(ping);
+
+            if (attempts >= 10) {
+                fprintf(stderr, "ERROR: Failed to receive ping message from crash report mover.\n");
+            }
+        });
+
+        serviceIds = QStringList() << "com.apple.crashreportcopymobile";
+        StartLockdown(true, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
+            afc_error_t err = afc_client_new(m_device, service, &m_crashlog);
+            if (err != AFC_E_SUCCESS)
+                m_errorHandler("ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
+        });
+        break;
+
+    case SERVICE_IMAGE_MOUNTER:
+        serviceIds << MOBILE_IMAGE_MOUNTER_SERVICE_NAME;
+        StartLockdown(true, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
+            mobile_image_mounter_error_t err = mobile_image_mounter_new(m_device, service, &m_imageMounter);
+            if (err != MOBILE_IMAGE_MOUNTER_E_SUCCESS)
+                m_errorHandler("ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
+        });
+        break;
+
+    case SERVICE_SCREENSHOT:
+        serviceIds << SCREENSHOTR_SERVICE_NAME;
+        StartLockdown(true, serviceIds, [this](QString& service_id, lockdownd_service_descriptor_t& service){
+            screenshotr_error_t err = screenshotr_client_new(m_device, service, &m_screenshot);
+            if (err != SCREENSHOTR_E_SUCCESS)
+                m_errorHandler("ERROR: Could not connect to " + service_id + " client! " + QString::number(err));
+        });
+        break;
+
+    default:
+        break;
+    }
+}
+
+bool DeviceSession::IsServiceOpen(ServiceType type)
+{
+    switch (type)
+    {
+    case SERVICE_INSTALLER:
+        return m_installer != nullptr;
+    case SERVICE_AFC:
+        return m_afc != nullptr;
+    case SERVICE_CRASHLOG:
+        return m_crashlog != nullptr;
+    case SERVICE_IMAGE_MOUNTER:
+        return m_imageMounter != nullptr;
+    case SERVICE_SCREENSHOT:
+        return m_screenshot != nullptr;
+    default:
+        return false;
+    }
+}
+
+void DeviceSession::FreeService(ServiceType type, bool hangup)
+{
+    switch (type)
+    {
+    case SERVICE_INSTALLER:
+        if (m_installer)
+        {
+            instproxy_client_free(m_installer);
+            m_installer = nullptr;
+        }
+        break;
+
+    case SERVICE_AFC:
+        // extra com.apple.afc connections opened for parallel uploads, checked out ones go when they are returned
+        {
+            QMutexLocker locker(&m_afcPoolMutex);
+            foreach (afc_client_t client, m_afcPool)
+                afc_client_free(client);
+            m_afcPoolOpen -= m_afcPool.count();
+            m_afcPool.clear();
+        }
+        if (m_afc)
+        {
+            afc_client_free(m_afc);
+            m_afc = nullptr;
+        }
+        break;
+
+    case SERVICE_CRASHLOG:
+        if (m_crashlog)
+        {
+            afc_client_free(m_crashlog);
+            m_crashlog = nullptr;
+        }
+        break;
+
+    case SERVICE_IMAGE_MOUNTER:
+        if (m_imageMounter)
+        {
+            if (hangup)
+                mobile_image_mounter_hangup(m_imageMounter);
+            mobile_image_mounter_free(m_imageMounter);
+            m_imageMounter = nullptr;
+        }
+        break;
+
+    case SERVICE_SCREENSHOT:
+        if (m_screenshot)
+        {
+            screenshotr_client_free(m_screenshot);
+            m_screenshot = nullptr;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+void DeviceSession::FreeIdleServices()
+{
+    for (int type = 0; type < SERVICE_COUNT; type++)
+    {
+        // a busy service is skipped rather than waited for, the next tick gets it
+        ServiceState& state = m_services[type];
+        if (!state.mutex.tryLock())
+            continue;
+        if (state.users == 0 && state.used.isValid() && state.used.elapsed() > SERVICE_IDLE_TIMEOUT_MS && IsServiceOpen((ServiceType)type))
+        {
+            FreeService((ServiceType)type);
+            state.used.invalidate();
+        }
+        state.mutex.unlock();
+    }
+}
+
+QList<afc_client_t> DeviceSession::CheckoutAfcPool(int wanted)
+{
+    QMutexLocker locker(&m_afcPoolMutex);
+    // idle connections first, new ones are opened while the pool is below its size
+    while (m_afcPool.count() < wanted && m_afcPoolOpen < AFC_POOL_SIZE - 1)
+    {
+        afc_client_t client = nullptr;
+        StartLockdown(true, QStringList() << "com.apple.afc", [this, &client](QString& service_id, lockdownd_service_descriptor_t& service){
+            if (afc_client_new(m_device, service, &client) != AFC_E_SUCCESS)
+                client = nullptr;
+        });
+        if (!client)
+            break;
+        m_afcPool << client;
+        m_afcPoolOpen++;
+    }
+
+    QList<afc_client_t> clients = m_afcPool.mid(0, qMax(0, wanted));
+    m_afcPool.remove(0, clients.count());
+    return clients;
+}
+
+void DeviceSession::ReturnAfcPool(const QList<afc_client_t> &clients)
+{
+    QMutexLocker locker(&m_afcPoolMutex);
+    m_afcPool << clients;
+}
+
+bool DeviceSession::StartSyslog(syslog_relay_receive_cb_t callback)
+{
+    if (!m_syslog)
+        return false;
+    if (m_syslogCapturing)
+        return true;
+
+    /* start capturing syslog */
+    syslog_relay_error_t err = syslog_relay_start_capture_raw(m_syslog, callback, nullptr);
+    if (err != SYSLOG_RELAY_E_SUCCESS) {
+        m_errorHandler("ERROR: Unable to start capturing syslog.");
+        syslog_relay_client_free(m_syslog);
+        m_syslog = nullptr;
+        return false;
+    }
+    m_syslogCapturing = true;
+    return true;
+}
+
+void DeviceSession::StopSyslog()
+{
+    if (m_syslog && m_syslogCapturing)
+        syslog_relay_stop_capture(m_syslog);
+    m_syslogCapturing = false;
+}
+
+QMap<QString, PlistView> DeviceSession::GetInstalledApps()
+{
+    QMutexLocker locker(&m_appsMutex);
+    return m_installedApps;
+}
+
+void DeviceSession::SetInstalledApps(const QMap<QString, PlistView> &apps)
+{
+    QMutexLocker locker(&m_appsMutex);
+    m_installedApps = apps;
+}
+
+void DeviceSession::StartInstallTimer(const QString &bundle_id, const QString &timings)
+{
+    QMutexLocker locker(&m_installTimingsMutex);
+    InstallTiming& timing = m_installTimings[bundle_id];
+    timing.phases = timings;
+    timing.timer.start();
+}
+
+QString DeviceSession::TakeInstallTimings(const QString &bundle_id)
+{
+    QMutexLocker locker(&m_installTimingsMutex);
+    auto it = m_installTimings.find(bundle_id);
+    if (it == m_installTimings.end())
+        return QString();
+    QString timings = (it->phases.isEmpty() ? "" : it->phases + ", ") + QString("install %1 ms").arg(it->timer.elapsed());
+    m_installTimings.erase(it);
+    return timings;
+}
+
+void DeviceSession::AddInstallerLease(const QString &operation, const std::shared_ptr<void> &lease)
+{
+    QMutexLocker locker(&m_installerLeasesMutex);
+    m_installerLeases.insert(operation, lease);
+}
+
+void DeviceSession::ReleaseInstallerLease(const QString &operation)
+{
+    // the lease is dropped outside the lock, its release takes the installer's service mutex
+    std::shared_ptr<void> lease;
+    QMutexLocker locker(&m_installerLeasesMutex);
+    auto it = m_installerLeases.find(operation);
+    if (it == m_installerLeases.end())
+        return;
+    lease = it.value();
+    m_installerLeases.erase(it);
+    locker.unlock();
+}
@@ -0,0 +1,133 @@
+#ifndef DEVICESESSION_H
+#define DEVICESESSION_H
+
+#include <QString>
+#include <QStringList>
+#include <QMap>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <functional>
+#include <memory>
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <libimobiledevice/syslog_relay.h>
+#include <libimobiledevice/installation_proxy.h>
+#include <libimobiledevice/afc.h>
+#include <libimobiledevice/mobile_image_mounter.h>
+#include <libimobiledevice/screenshotr.h>
+#include <libimobiledevice/service.h>
+#include "plistview.h"
+#include "asyncmanager.h"
+
+#define SERVICE_IDLE_TIMEOUT_MS         60000
+
+enum ServiceType {
+    SERVICE_INSTALLER,
+    SERVICE_AFC,
+    SERVICE_CRASHLOG,
+    SERVICE_IMAGE_MOUNTER,
+    SERVICE_SCREENSHOT,
+    SERVICE_COUNT
+};
+
+// one connected device: its lockdown client, service clients and caches
+class DeviceSession
+{
+public:
+    DeviceSession(const QString& udid, idevice_connection_type type, const std::function<void(const QString&)>& error_handler);
+    ~DeviceSession();
+
+    bool Connect(QStringList& timings_out);
+    void Close(bool hangup = true);
+    // closes only when no service has a holder, running work keeps the session open
+    bool CloseIfIdle();
+    bool IsConnected();
+    bool IsAlive();
+    // a session switched away from stays warm, only the cheap services are kept
+    void SetActive(bool active);
+    qint64 InactiveMsecs();
+    QString GetUdid() { return m_udid; }
+    idevice_connection_type GetConnectionType() { return m_connectionType; }
+    PlistView GetDeviceInfo() { return m_deviceInfo; }
+    // work queued for this device, cancelled when the session is closed
+    CancellationToken Token() { return m_token; }
+
+    void StartLockdown(bool condition, QStringList service_ids, const std::function<void(QString& service_id, lockdownd_service_descriptor_t& service)>& function);
+    // service clients are opened on first use and freed after SERVICE_IDLE_TIMEOUT_MS without a holder
+    std::shared_ptr<void> AcquireService(ServiceType type);
+    bool IsServiceOpen(ServiceType type);
+    void FreeIdleServices();
+
+    bool StartSyslog(syslog_relay_receive_cb_t callback);
+    void StopSyslog();
+
+    QMap<QString, PlistView> GetInstalledApps();
+    void SetInstalledApps(const QMap<QString, PlistView>& apps);
+    // start of the last full browse, invalid until one ran
+    QElapsedTimer& InstalledAppsRefreshed() { return m_installedAppsRefreshed; }
+
+    idevice_t Device() { return m_device; }
+    instproxy_client_t Installer() { return m_installer; }
+    afc_client_t& Afc() { return m_afc; }
+    afc_client_t& Crashlog() { return m_crashlog; }
+    mobile_image_mounter_client_t ImageMounter() { return m_imageMounter; }
+    screenshotr_client_t Screenshot() { return m_screenshot; }
+    // extra com.apple.afc connections for parallel uploads, a client is used by one transfer at a time
+    QList<afc_client_t> CheckoutAfcPool(int wanted);
+    void ReturnAfcPool(const QList<afc_client_t>& clients);
+    // instproxy reports on its own thread, each operation holds the installer open until it reports 100%
+    // operations are "<Command>:<bundle id>" as instproxy names them in its status callback
+    void AddInstallerLease(const QString& operation, const std::shared_ptr<void>& lease);
+    void ReleaseInstallerLease(const QString& operation);
+    // phases of an install handed to instproxy, reported with its final status for that bundle
+    void StartInstallTimer(const QString& bundle_id, const QString& timings);
+    QString TakeInstallTimings(const QString& bundle_id);
+
+private:
+    bool Shutdown(bool hangup, bool only_idle);
+    void OpenService(ServiceType type);
+    void FreeService(ServiceType type, bool hangup = true);
+
+    struct ServiceState
+    {
+        QMutex mutex;
+        int users = 0;
+        QElapsedTimer used;
+    };
+
+    QString m_udid;
+    idevice_connection_type m_connectionType;
+    std::function<void(const QString&)> m_errorHandler;
+    idevice_t m_device;
+    lockdownd_client_t m_client;
+    QMutex m_lockdownMutex;
+    instproxy_client_t m_installer;
+    afc_client_t m_afc;
+    afc_client_t m_crashlog;
+    QList<afc_client_t> m_afcPool;
+    int m_afcPoolOpen;
+    QMutex m_afcPoolMutex;
+    mobile_image_mounter_client_t m_imageMounter;
+    screenshotr_client_t m_screenshot;
+    syslog_relay_client_t m_syslog;
+    bool m_syslogCapturing;
+    QElapsedTimer m_inactive;
+    ServiceState m_services[SERVICE_COUNT];
+    QMultiMap<QString, std::shared_ptr<void>> m_installerLeases;
+    QMutex m_installerLeasesMutex;
+    PlistView m_deviceInfo;
+    CancellationToken m_token;
+    QMap<QString, PlistView> m_installedApps;
+    QElapsedTimer m_installedAppsRefreshed;
+    QMutex m_appsMutex;
+    struct InstallTiming
+    {
+        QElapsedTimer timer;
+        QString phases;
+    };
+    QMap<QString, InstallTiming> m_installTimings;
+    QMutex m_installTimingsMutex;
+};
+
+#endif // DEVICESESSION_H
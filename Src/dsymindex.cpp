@@ -0,0 +1,364 @@
+#include "dsymindex.h"
+#include "utils.h"
+#include "userconfigs.h"
+#include "asyncmanager.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QSaveFile>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QRegularExpression>
+#include <QtEndian>
+
+const quint32 kMH_MAGIC = 0xfeedface;
+const quint32 kMH_MAGIC_64 = 0xfeedfacf;
+const quint32 kFAT_MAGIC = 0xcafebabe;
+const quint32 kLC_UUID = 0x1b;
+const quint32 kCPU_ARCH_ABI64 = 0x01000000;
+const quint32 kCPU_TYPE_X86 = 7;
+const quint32 kCPU_TYPE_ARM = 12;
+
+DsymIndex *DsymIndex::m_instance = nullptr;
+DsymIndex *DsymIndex::Get()
+{
+    if(!m_instance)
+        m_instance = new DsymIndex();
+    return m_instance;
+}
+
+void DsymIndex::Destroy()
+{
+    if (m_instance)
+    {
+        delete m_instance;
+        m_instance = nullptr;
+    }
+}
+
+DsymIndex::DsymIndex()
+    : m_loaded(false)
+{
+}
+
+void DsymIndex::AddSearchPath(QString path)
+{
+    path = QFileInfo(path).absoluteFilePath();
+    {
+        QMutexLocker locker(&m_mutex);
+        ReadFromFile();
+        if (m_searchPaths.contains(path))
+            return;
+        m_searchPaths << path;
+    }
+    UserConfigs::Get()->SaveData("DsymSearchPaths", GetSearchPaths());
+}
+
+QStringList DsymIndex::GetSearchPaths()
+{
+    QMutexLocker locker(&m_mutex);
+    ReadFromFile();
+    return m_searchPaths;
+}
+
+void DsymIndex::Refresh()
+{
+    QStringList searchPaths;
+    QMap<QString, FileRecord> files;
+    {
+        QMutexLocker locker(&m_mutex);
+        ReadFromFile();
+        searchPaths = m_searchPaths;
+        files = m_files;
+    }
+
+    // only files that are still under a search path survive the refresh
+    QMap<QString, FileRecord> scanned;
+    foreach (const QString& path, searchPaths)
+    {
+        QMap<QString, FileRecord> found;
+        foreach (const QString& filepath, files.keys())
+        {
+            if (filepath.startsWith(path))
+                found[filepath] = files[filepath];
+        }
+        ScanPath(path, found);
+        scanned.insert(found);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_files = scanned;
+    RebuildUUIDs();
+    SaveToFile();
+}
+
+bool DsymIndex::Lookup(QString uuid, Entry &entry_out)
+{
+    QMutexLocker locker(&m_mutex);
+    ReadFromFile();
+    auto it = m_uuids.constFind(NormalizeUUID(uuid));
+    if (it == m_uuids.constEnd() || !QFileInfo::exists(it->path))
+        return false;
+    entry_out = it.value();
+    return true;
+}
+
+void DsymIndex::Locate(QString crashlogPath)
+{
+    AsyncManager::Get()->StartAsyncRequest([this, crashlogPath]() {
+        QStringList uuids = ReadCrashlogUUIDs(crashlogPath);
+        for (int pass = 0; pass < 2; pass++)
+        {
+            foreach (const QString& uuid, uuids)
+            {
+                Entry entry;
+                if (Lookup(uuid, entry))
+                {
+                    emit DsymLocated(crashlogPath, entry.path, entry.arch);
+                    return;
+                }
+            }
+
+            // miss on the cached index, pick up new or changed dSYMs once
+            if (pass == 0)
+                Refresh();
+        }
+        emit DsymLocated(crashlogPath, "", "");
+    }, TASK_BACKGROUND);
+}
+
+QString DsymIndex::NormalizeUUID(QString uuid)
+{
+    return uuid.remove('-').remove('<').remove('>').trimmed().toUpper();
+}
+
+QStringList DsymIndex::ReadCrashlogUUIDs(QString crashlogPath)
+{
+    QStringList uuids;
+    QFile file(crashlogPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return uuids;
+    QString content = QString::fromUtf8(file.readAll());
+    file.close();
+
+    // the crashed process comes first, .ips lists it in usedImages, legacy in Binary Images
+    static const QRegularExpression ipsRegex("\"uuid\"\\s*:\\s*\"([0-9a-fA-F-]{36})\"");
+    static const QRegularExpression legacyRegex("<([0-9a-fA-F]{32})>");
+    QRegularExpressionMatchIterator it = ipsRegex.globalMatch(content);
+    if (!it.hasNext())
+        it = legacyRegex.globalMatch(content);
+    while (it.hasNext())
+    {
+        QString uuid = NormalizeUUID(it.next().captured(1));
+        if (!uuids.contains(uuid))
+            uuids << uuid;
+    }
+    return uuids;
+}
+
+void DsymIndex::ScanPath(QString path, QMap<QString, FileRecord> &files)
+{
+    QStringList candidates;
+    QFileInfo root(path);
+    if (root.isFile())
+    {
+        candidates << root.absoluteFilePath();
+    }
+    else
+    {
+        QDirIterator it(path, QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (it.hasNext())
+        {
+            QString filepath = it.next();
+            if (filepath.contains(".dSYM/Contents/Resources/DWARF/", Qt::CaseInsensitive))
+                candidates << filepath;
+        }
+    }
+
+    QMap<QString, FileRecord> updated;
+    foreach (const QString& filepath, candidates)
+    {
+        QFileInfo info(filepath);
+        FileRecord record;
+        record.mtime = info.lastModified().toSecsSinceEpoch();
+        record.size = info.size();
+
+        auto cached = files.constFind(filepath);
+        if (cached != files.constEnd() && cached->mtime == record.mtime && cached->size == record.size)
+        {
+            updated[filepath] = cached.value();
+            continue;
+        }
+        if (ReadMachOSlices(filepath, record.slices))
+            updated[filepath] = record;
+    }
+    files = updated;
+}
+
+void DsymIndex::RebuildUUIDs()
+{
+    m_uuids.clear();
+    foreach (const QString& filepath, m_files.keys())
+    {
+        // prefer the bundle, it is what the dSYM picker hands to the symbolicator
+        QString bundle = filepath;
+        qsizetype idx = filepath.indexOf(".dSYM/", 0, Qt::CaseInsensitive);
+        if (idx >= 0)
+            bundle = filepath.mid(0, idx + 5);
+
+        foreach (const Slice& slice, m_files[filepath].slices)
+            m_uuids[slice.uuid] = { bundle, slice.arch };
+    }
+}
+
+void DsymIndex::ReadFromFile()
+{
+    if (m_loaded)
+        return;
+    m_loaded = true;
+    m_searchPaths = UserConfigs::Get()->GetData("DsymSearchPaths", QStringList());
+
+    QFile file(GetDirectory(DIRECTORY_TYPE::LOCALDATA) + "dsymindex.json");
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    QJsonObject files = QJsonDocument::fromJson(file.readAll()).object();
+    file.close();
+
+    foreach (const QString& filepath, files.keys())
+    {
+        QJsonObject item = files[filepath].toObject();
+        FileRecord record;
+        record.mtime = item["mtime"].toInteger();
+        record.size = item["size"].toInteger();
+        foreach (const auto& value, item["slices"].toArray())
+            record.slices << Slice { value["uuid"].toString(), value["arch"].toString() };
+        m_files[filepath] = record;
+    }
+    RebuildUUIDs();
+}
+
+void DsymIndex::SaveToFile()
+{
+    QJsonObject files;
+    foreach (const QString& filepath, m_files.keys())
+    {
+        const FileRecord& record = m_files[filepath];
+        QJsonArray slices;
+        foreach (const Slice& slice, record.slices)
+        {
+            QJsonObject value;
+            value["uuid"] = slice.uuid;
+            value["arch"] = slice.arch;
+            slices.append(value);
+        }
+        QJsonObject item;
+        item["mtime"] = record.mtime;
+        item["size"] = record.size;
+        item["slices"] = slices;
+        files[filepath] = item;
+    }
+
+    QDir().mkpath(GetDirectory(DIRECTORY_TYPE::LOCALDATA));
+    QSaveFile file(GetDirectory(DIRECTORY_TYPE::LOCALDATA) + "dsymindex.json");
+    if (file.open(QIODevice::WriteOnly))
+    {
+        file.write(QJsonDocument(files).toJson(QJsonDocument::Compact));
+        file.commit();
+    }
+}
+
+bool DsymIndex::ReadMachOSlices(QString path, QList<Slice> &slices_out)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QList<QPair<qint64, qint64>> ranges;
+    QByteArray fatHeader = file.read(8);
+    if (fatHeader.size() < 8)
+        return false;
+
+    if (qFromBigEndian<quint32>(fatHeader.constData()) == kFAT_MAGIC)
+    {
+        quint32 count = qFromBigEndian<quint32>(fatHeader.constData() + 4);
+        for (quint32 idx = 0; idx < count && idx < 64; idx++)
+        {
+            QByteArray arch = file.read(20);
+            if (arch.size() < 20)
+                return false;
+            ranges << qMakePair<qint64, qint64>(qFromBigEndian<quint32>(arch.constData() + 8), qFromBigEndian<quint32>(arch.constData() + 12));
+        }
+    }
+    else
+    {
+        ranges << qMakePair<qint64, qint64>(0, file.size());
+    }
+
+    foreach (const auto& range, ranges)
+    {
+        if (!file.seek(range.first))
+            continue;
+        QByteArray header = file.read(32);
+        if (header.size() < 28)
+            continue;
+
+        quint32 magic = qFromLittleEndian<quint32>(header.constData());
+        bool swapped = false;
+        if (magic != kMH_MAGIC && magic != kMH_MAGIC_64)
+        {
+            magic = qFromBigEndian<quint32>(header.constData());
+            swapped = true;
+        }
+        if (magic != kMH_MAGIC && magic != kMH_MAGIC_64)
+            continue;
+
+        auto read32 = [swapped](const char* data) {
+            return swapped ? qFromBigEndian<quint32>(data) : qFromLittleEndian<quint32>(data);
+        };
+        quint32 cputype = read32(header.constData() + 4);
+        quint32 cpusubtype = read32(header.constData() + 8);
+        quint32 ncmds = read32(header.constData() + 16);
+        quint32 sizeofcmds = read32(header.constData() + 20);
+        qint64 headerSize = magic == kMH_MAGIC_64 ? 32 : 28;
+
+        if (!file.seek(range.first + headerSize))
+            continue;
+        QByteArray commands = file.read(qMin<qint64>(sizeofcmds, range.second));
+        qint64 offset = 0;
+        for (quint32 idx = 0; idx < ncmds && offset + 8 <= commands.size(); idx++)
+        {
+            quint32 cmd = read32(commands.constData() + offset);
+            quint32 cmdsize = read32(commands.constData() + offset + 4);
+            if (cmd == kLC_UUID && offset + 24 <= commands.size())
+            {
+                QString uuid = commands.mid(offset + 8, 16).toHex().toUpper();
+                slices_out << Slice { uuid, ArchName(cputype, cpusubtype & 0x00ffffff) };
+                break;
+            }
+            if (cmdsize < 8)
+                break;
+            offset += cmdsize;
+        }
+    }
+    return !slices_out.isEmpty();
+}
+
+QString DsymIndex::ArchName(quint32 cputype, quint32 cpusubtype)
+{
+    switch (cputype)
+    {
+    case kCPU_TYPE_ARM | kCPU_ARCH_ABI64:
+        return cpusubtype == 2 ? "arm64e" : "arm64";
+    case kCPU_TYPE_ARM:
+        return cpusubtype == 11 ? "armv7s" : (cpusubtype == 12 ? "armv7k" : "armv7");
+    case kCPU_TYPE_X86 | kCPU_ARCH_ABI64:
+        return "x86_64";
+    case kCPU_TYPE_X86:
+        return "i386";
+    default:
+        break;
+    }
+    return QString("cpu%1").arg(cputype);
+}
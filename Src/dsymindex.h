@@ -0,0 +1,65 @@
+#ifndef DSYMINDEX_H
+#define DSYMINDEX_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMap>
+
+class DsymIndex : public QObject
+{
+    Q_OBJECT
+public:
+    static DsymIndex *Get();
+    static void Destroy();
+    DsymIndex();
+
+    struct Entry
+    {
+        QString path;
+        QString arch;
+    };
+
+    void AddSearchPath(QString path);
+    QStringList GetSearchPaths();
+    void Refresh();
+    bool Lookup(QString uuid, Entry& entry_out);
+    void Locate(QString crashlogPath);
+
+    static QString NormalizeUUID(QString uuid);
+    static QStringList ReadCrashlogUUIDs(QString crashlogPath);
+
+private:
+    struct Slice
+    {
+        QString uuid;
+        QString arch;
+    };
+    struct FileRecord
+    {
+        qint64 mtime;
+        qint64 size;
+        QList<Slice> slices;
+    };
+
+    void ScanPath(QString path, QMap<QString, FileRecord>& files);
+    void RebuildUUIDs();
+    void ReadFromFile();
+    void SaveToFile();
+    static bool ReadMachOSlices(QString path, QList<Slice>& slices_out);
+    static QString ArchName(quint32 cputype, quint32 cpusubtype);
+
+    static DsymIndex *m_instance;
+    QMap<QString, FileRecord> m_files;
+    QMap<QString, Entry> m_uuids;
+    QStringList m_searchPaths;
+    bool m_loaded;
+    QMutex m_mutex;
+
+signals:
+    void DsymLocated(QString crashlogPath, QString dsymPath, QString arch);
+};
+
+#endif // DSYMINDEX_H
@@ -6,21 +6,7 @@
 
 QJsonObject PlistToJsonObject(plist_t node)
 {
-    QJsonObject jsonObject;
-    plist_dict_iter it = nullptr;
-    char* key = nullptr;
-    plist_t subnode = nullptr;
-    plist_dict_new_iter(node, &it);
-    plist_dict_next_item(node, it, &key, &subnode);
-    while (subnode)
-    {
-        jsonObject.insert(key, PlistNodeToJsonValue(subnode));
-        free(key);
-        key = nullptr;
-        plist_dict_next_item(node, it, &key, &subnode);
-    }
-    free(it);
-    return jsonObject;
+    return PlistDictToJsonValue(node).toObject();
 }
 
 QJsonDocument PlistToJson(plist_t node)
@@ -45,16 +31,7 @@ QJsonDocument PlistToJson(plist_t node)
 
 QJsonArray PlistToJsonArray(plist_t node)
 {
-    QJsonArray arr;
-    int i, count;
-    plist_t subnode = nullptr;
-
-    count = plist_array_get_size(node);
-    for (i = 0; i < count; i++) {
-        subnode = plist_array_get_item(node, i);
-        arr.insert(0, PlistToJsonObject(subnode));
-    }
-    return arr;
+    return PlistArrayToJsonValue(node).toArray();
 }
 
 QJsonValue PlistNodeToJsonValue(plist_t node)
@@ -92,7 +69,7 @@ QJsonValue PlistNodeToJsonValue(plist_t node)
 
     case PLIST_STRING:
         plist_get_string_val(node, &s);
-        jsonValue = s;
+        jsonValue = QString::fromUtf8(s);
         free(s);
         break;
 
@@ -105,9 +82,10 @@ QJsonValue PlistNodeToJsonValue(plist_t node)
     case PLIST_DATA:
         plist_get_data_val(node, &data, &u);
         if (u > 0) {
-            QString str = Base64Encode(data);
-            jsonValue = str;
+            // binary payloads may contain NUL, encode the whole buffer
+            jsonValue = QString::fromLatin1(QByteArray::fromRawData(data, (qsizetype)u).toBase64());
         }
+        free(data);
         break;
 
     case PLIST_DATE:
@@ -147,7 +125,10 @@ QJsonValue PlistNodeToJsonValue(plist_t node)
 
 QJsonValue PlistDictToJsonValue(plist_t node)
 {
-    QJsonValue jsonValue;
+    QJsonObject jsonObject;
+    if (!node || plist_get_node_type(node) != PLIST_DICT)
+        return jsonObject;
+
     plist_dict_iter it = nullptr;
     char* key = nullptr;
     plist_t subnode = nullptr;
@@ -155,29 +136,24 @@ QJsonValue PlistDictToJsonValue(plist_t node)
     plist_dict_next_item(node, it, &key, &subnode);
     while (subnode)
     {
-        QJsonObject jsonObject;
-        jsonObject.insert(key, PlistNodeToJsonValue(subnode));
-        jsonValue = jsonObject;
+        jsonObject.insert(QString::fromUtf8(key), PlistNodeToJsonValue(subnode));
         free(key);
         key = nullptr;
         plist_dict_next_item(node, it, &key, &subnode);
     }
+    free(key);
     free(it);
-    return jsonValue;
+    return jsonObject;
 }
 
 QJsonValue PlistArrayToJsonValue(plist_t node)
 {
-    QJsonValue jsonValue;
-    int i, count;
-    plist_t subnode = nullptr;
+    if (!node || plist_get_node_type(node) != PLIST_ARRAY)
+        return QJsonArray();
 
-    count = plist_array_get_size(node);
+    uint32_t count = plist_array_get_size(node);
     QJsonArray arr;
-    for (i = 0; i < count; i++) {
-        subnode = plist_array_get_item(node, i);
-        arr.push_back(PlistNodeToJsonValue(subnode));
-    }
-    jsonValue = arr;
-    return jsonValue;
+    for (uint32_t i = 0; i < count; i++)
+        arr.append(PlistNodeToJsonValue(plist_array_get_item(node, i)));
+    return arr;
 }
@@ -32,7 +32,6 @@ bool ZipGetContents(QString zip_file, QString inside_path, std::vector<char>& da
             data_out = std::vector<char>(data_temp.begin(), data_temp.end());
             return true;
         }
-        qDebug() << "Not found";
     }
     catch ( const BitException& ex )
     {
@@ -65,7 +64,47 @@ bool ZipGetAppDirectory(QString zip_file, QString &path_out)
                 return true;
             }
         }
-        qDebug() << "Not found";
+    }
+    catch ( const BitException& ex )
+    {
+        qDebug() << ex.what();
+    }
+    return false;
+}
+
+bool ZipGetAppInfo(QString zip_file, QString &path_out, std::vector<char> &info_out)
+{
+    try
+    {
+#if defined(WIN32) && defined(NDEBUG)
+        Bit7zLibrary lib{ "7z.dll" };
+#elif defined(WIN32) && defined(DEBUG)
+        Bit7zLibrary lib{ "7z_d.dll" };
+#elif defined(NDEBUG)
+        Bit7zLibrary lib{ "7z.so" };
+#elif defined(DEBUG)
+        Bit7zLibrary lib{ "7z_d.so" };
+#endif
+        // one walk of the central directory finds both the app directory and its Info.plist
+        BitArchiveReader arc{ lib, zip_file.toStdString(), BitFormat::Zip };
+        for (auto it = arc.begin(); it != arc.end(); ++it)
+        {
+            QString path_in(it->path().c_str());
+            qsizetype idx = path_in.indexOf(".app", 0, Qt::CaseInsensitive);
+            if (idx < 0)
+                continue;
+
+            if (path_out.isEmpty())
+                path_out = path_in.mid(0, idx + 4);
+            QString inside = path_in.mid(idx + 4);
+            if (path_in.startsWith(path_out) && (inside == "\\Info.plist" || inside == "/Info.plist"))
+            {
+                std::vector<byte_t> data_temp;
+                arc.extract(data_temp, it->index());
+                info_out = std::vector<char>(data_temp.begin(), data_temp.end());
+                return true;
+            }
+        }
     }
     catch ( const BitException& ex )
     {
@@ -4,6 +4,7 @@
 #include <QSaveFile>
 #include <QMessageBox>
 #include <QJsonObject>
+#include <QPointer>
 #include <ui_imagemounter.h>
 #include <zip.h>
 #include "utils.h"
@@ -232,8 +233,30 @@ void ImageMounter::OnSignatureClicked()
 
 void ImageMounter::OnMountClicked()
 {
-    DeviceBridge::Get()->MountImage(ui->imageEdit->text(), ui->signatureEdit->text());
-    RefreshUI(false);
+    MountImage(ui->imageEdit->text(), ui->signatureEdit->text());
+}
+
+void ImageMounter::MountImage(QString image_path, QString signature_path)
+{
+    // the mount runs on the pool, the mounted state is only worth reading once it is done
+    ui->mountBtn->setEnabled(false);
+    ui->mount2Btn->setEnabled(false);
+    QPointer<ImageMounter> dialog(this);
+    DeviceBridge::Get()->MountImage(image_path, signature_path).Then([dialog](AsyncTask<bool> task) {
+        bool cancelled = task.IsCancelled();
+        if (dialog)
+        {
+            QMetaObject::invokeMethod(dialog, [dialog, cancelled]() {
+                if (!dialog)
+                    return;
+                if (cancelled)
+                    dialog->OnMounterStatusChanged("Device disconnected, mount cancelled!");
+                dialog->ui->mountBtn->setEnabled(true);
+                dialog->ui->mount2Btn->setEnabled(true);
+                dialog->RefreshUI(false);
+            }, Qt::QueuedConnection);
+        }
+    });
 }
 
 void ImageMounter::OnDownloadMountClicked()
@@ -256,8 +279,7 @@ void ImageMounter::OnDownloadMountClicked()
     {
         QString image_path = diskImages.filter(QRegularExpression(".dmg$")).at(0);
         QString signature_path = diskImages.filter(QRegularExpression(".signature$")).at(0);
-        DeviceBridge::Get()->MountImage(image_path, signature_path);
-        RefreshUI(false);
+        MountImage(image_path, signature_path);
     }
     else
     {
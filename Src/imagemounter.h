@@ -35,6 +35,7 @@ private:
         DONE
     };
     void ChangeDownloadState(DOWNLOAD_STATE downloadState);
+    void MountImage(QString image_path, QString signature_path);
 
     Ui::ImageMounter *ui;
     DOWNLOAD_STATE m_downloadState;
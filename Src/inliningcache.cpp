@@ -0,0 +1,208 @@
+#include "inliningcache.h"
+#include "utils.h"
+#include <QDir>
+#include <QSaveFile>
+#include <QtEndian>
+
+const quint32 kINLINING_MAGIC = 0x434c4e49; // "INLC"
+const quint32 kINLINING_VERSION = 1;
+const qint64 kINLINING_HEADER_SIZE = 12;
+const qint64 kINLINING_ENTRY_SIZE = 16;
+
+InliningCache *InliningCache::m_instance = nullptr;
+InliningCache *InliningCache::Get()
+{
+    if(!m_instance)
+        m_instance = new InliningCache();
+    return m_instance;
+}
+
+void InliningCache::Destroy()
+{
+    if (m_instance)
+    {
+        delete m_instance;
+        m_instance = nullptr;
+    }
+}
+
+InliningCache::InliningCache()
+{
+}
+
+InliningCache::~InliningCache()
+{
+    Flush();
+    foreach (const auto& image, m_images)
+        Unmap(*image);
+}
+
+QString InliningCache::Resolve(const QString &uuid, quint64 address, const std::function<QString (quint64)> &resolver)
+{
+    std::shared_ptr<Image> image = Open(uuid);
+    {
+        QMutexLocker locker(&image->mutex);
+        auto it = image->pending.constFind(address);
+        if (it != image->pending.constEnd())
+            return it.value();
+
+        QString symbol;
+        if (FindMapped(*image, address, symbol))
+            return symbol;
+    }
+
+    // only misses reach the DWARF parser, they are persisted on the next flush
+    QString symbol = resolver ? resolver(address) : QString();
+    QMutexLocker locker(&image->mutex);
+    image->pending.insert(address, symbol);
+    return symbol;
+}
+
+void InliningCache::Flush()
+{
+    QHash<QString, std::shared_ptr<Image>> images;
+    {
+        QMutexLocker locker(&m_mutex);
+        images = m_images;
+    }
+
+    foreach (const QString& uuid, images.keys())
+    {
+        Image& image = *images[uuid];
+        QMutexLocker locker(&image.mutex);
+        if (image.pending.isEmpty())
+            continue;
+        Write(uuid, image);
+    }
+}
+
+std::shared_ptr<InliningCache::Image> InliningCache::Open(const QString &uuid)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_images.constFind(uuid);
+    if (it != m_images.constEnd())
+        return it.value();
+
+    auto image = std::make_shared<Image>();
+    image->file.setFileName(PathOf(uuid));
+    Map(*image);
+    m_images.insert(uuid, image);
+    return image;
+}
+
+void InliningCache::Map(Image &image)
+{
+    if (!image.file.open(QIODevice::ReadOnly))
+        return;
+
+    qint64 size = image.file.size();
+    const uchar* data = size >= kINLINING_HEADER_SIZE ? image.file.map(0, size) : nullptr;
+    if (data == nullptr)
+    {
+        image.file.close();
+        return;
+    }
+
+    quint32 count = qFromLittleEndian<quint32>(data + 8);
+    if (qFromLittleEndian<quint32>(data) != kINLINING_MAGIC
+        || qFromLittleEndian<quint32>(data + 4) != kINLINING_VERSION
+        || kINLINING_HEADER_SIZE + count * kINLINING_ENTRY_SIZE > size)
+    {
+        image.file.unmap(const_cast<uchar*>(data));
+        image.file.close();
+        return;
+    }
+    image.mapped = data;
+    image.mappedSize = size;
+    image.count = count;
+}
+
+void InliningCache::Unmap(Image &image)
+{
+    if (image.mapped)
+        image.file.unmap(const_cast<uchar*>(image.mapped));
+    image.file.close();
+    image.mapped = nullptr;
+    image.mappedSize = 0;
+    image.count = 0;
+}
+
+bool InliningCache::FindMapped(const Image &image, quint64 address, QString &symbol_out)
+{
+    if (image.mapped == nullptr)
+        return false;
+
+    const uchar* table = image.mapped + kINLINING_HEADER_SIZE;
+    qint64 blob = kINLINING_HEADER_SIZE + image.count * kINLINING_ENTRY_SIZE;
+    quint32 low = 0, high = image.count;
+    while (low < high)
+    {
+        quint32 mid = low + (high - low) / 2;
+        const uchar* entry = table + mid * kINLINING_ENTRY_SIZE;
+        quint64 value = qFromLittleEndian<quint64>(entry);
+        if (value < address)
+        {
+            low = mid + 1;
+        }
+        else if (value > address)
+        {
+            high = mid;
+        }
+        else
+        {
+            quint32 offset = qFromLittleEndian<quint32>(entry + 8);
+            quint32 length = qFromLittleEndian<quint32>(entry + 12);
+            if (blob + offset + length > image.mappedSize)
+                return false;
+            symbol_out = QString::fromUtf8((const char*)image.mapped + blob + offset, length);
+            return true;
+        }
+    }
+    return false;
+}
+
+void InliningCache::Write(const QString &uuid, Image &image)
+{
+    QMap<quint64, QString> entries = image.pending;
+    for (quint32 idx = 0; idx < image.count; idx++)
+    {
+        quint64 address = qFromLittleEndian<quint64>(image.mapped + kINLINING_HEADER_SIZE + idx * kINLINING_ENTRY_SIZE);
+        QString symbol;
+        if (!entries.contains(address) && FindMapped(image, address, symbol))
+            entries.insert(address, symbol);
+    }
+
+    QByteArray header(kINLINING_HEADER_SIZE + entries.count() * kINLINING_ENTRY_SIZE, 0);
+    QByteArray blob;
+    uchar* data = (uchar*)header.data();
+    qToLittleEndian<quint32>(kINLINING_MAGIC, data);
+    qToLittleEndian<quint32>(kINLINING_VERSION, data + 4);
+    qToLittleEndian<quint32>(entries.count(), data + 8);
+    uchar* entry = data + kINLINING_HEADER_SIZE;
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it, entry += kINLINING_ENTRY_SIZE)
+    {
+        QByteArray symbol = it.value().toUtf8();
+        qToLittleEndian<quint64>(it.key(), entry);
+        qToLittleEndian<quint32>(blob.size(), entry + 8);
+        qToLittleEndian<quint32>(symbol.size(), entry + 12);
+        blob.append(symbol);
+    }
+
+    // the mapping has to go before the file is replaced underneath it
+    Unmap(image);
+    QDir().mkpath(GetDirectory(DIRECTORY_TYPE::LOCALDATA) + "inlining");
+    QSaveFile file(PathOf(uuid));
+    if (file.open(QIODevice::WriteOnly))
+    {
+        file.write(header);
+        file.write(blob);
+        if (file.commit())
+            image.pending.clear();
+    }
+    Map(image);
+}
+
+QString InliningCache::PathOf(const QString &uuid)
+{
+    return GetDirectory(DIRECTORY_TYPE::LOCALDATA) + "inlining/" + uuid.toUpper() + ".inl";
+}
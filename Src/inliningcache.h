@@ -0,0 +1,48 @@
+#ifndef INLININGCACHE_H
+#define INLININGCACHE_H
+
+#include <QString>
+#include <QFile>
+#include <QMap>
+#include <QHash>
+#include <QMutex>
+#include <functional>
+#include <memory>
+
+class InliningCache
+{
+public:
+    static InliningCache *Get();
+    static void Destroy();
+    InliningCache();
+    ~InliningCache();
+
+    QString Resolve(const QString& uuid, quint64 address, const std::function<QString(quint64)>& resolver);
+    void Flush();
+
+private:
+    // sidecar layout, little endian:
+    // magic, version, count, count * { address(8), offset(4), length(4) } sorted by address, utf8 blob
+    struct Image
+    {
+        QFile file;
+        const uchar* mapped = nullptr;
+        qint64 mappedSize = 0;
+        quint32 count = 0;
+        QMap<quint64, QString> pending;
+        QMutex mutex;
+    };
+
+    std::shared_ptr<Image> Open(const QString& uuid);
+    static void Map(Image& image);
+    static void Unmap(Image& image);
+    static bool FindMapped(const Image& image, quint64 address, QString& symbol_out);
+    static void Write(const QString& uuid, Image& image);
+    static QString PathOf(const QString& uuid);
+
+    static InliningCache *m_instance;
+    QHash<QString, std::shared_ptr<Image>> m_images;
+    QMutex m_mutex;
+};
+
+#endif // INLININGCACHE_H
@@ -48,14 +48,7 @@ void LogFilterThread::LogsFilterByPID(QString pid_name)
     if (m_thread->isRunning())
         StopFilter();
 
-    if (pid_name.trimmed().contains("by user apps only", Qt::CaseInsensitive) || pid_name.trimmed().contains("related to user apps", Qt::CaseInsensitive))
-    {
-        m_pidFilter = m_pidlist[pid_name.trimmed().toLower()];
-    }
-    else
-    {
-        m_pidFilter = pid_name;
-    }
+    m_pidFilter = PidFilter(pid_name);
     StartFilter();
 }
 
@@ -64,25 +57,28 @@ void LogFilterThread::SystemLogsFilter(QString text_or_regex, QString pid_name,
     if (m_thread->isRunning())
         StopFilter();
 
-    if (pid_name.trimmed().contains("by user apps only", Qt::CaseInsensitive) || pid_name.trimmed().contains("related to user apps", Qt::CaseInsensitive))
-    {
-        m_pidFilter = m_pidlist[pid_name.trimmed().toLower()];
-    }
-    else
-    {
-        m_pidFilter = pid_name;
-    }
+    m_pidFilter = PidFilter(pid_name);
     m_currentFilter = text_or_regex;
     m_excludeFilter = exclude_text;
     StartFilter();
 }
 
+QString LogFilterThread::PidFilter(QString pid_name)
+{
+    if (pid_name.trimmed().contains("by user apps only", Qt::CaseInsensitive) || pid_name.trimmed().contains("related to user apps", Qt::CaseInsensitive))
+    {
+        QMutexLocker locker(&m_appsMutex);
+        return m_pidlist[pid_name.trimmed().toLower()];
+    }
+    return pid_name;
+}
+
 void LogFilterThread::ReloadLogsFilter()
 {
     SystemLogsFilter(m_currentFilter, m_pidFilter, m_excludeFilter);
 }
 
-void LogFilterThread::UpdateInstalledList(QMap<QString, QJsonDocument> applist)
+void LogFilterThread::UpdateInstalledList(QMap<QString, PlistView> applist)
 {
     QStringList userBinaries;
     foreach (auto appinfo, applist)
@@ -90,8 +86,18 @@ void LogFilterThread::UpdateInstalledList(QMap<QString, QJsonDocument> applist)
         QString bin_name = appinfo["CFBundleExecutable"].toString();
         userBinaries << bin_name;
     }
-    m_pidlist["by user apps only"] = userBinaries.join("\\[|") + "\\[";
-    m_pidlist["related to user apps"] = userBinaries.join("|");
+    userBinaries.sort();
+
+    // versions and paths change on every reinstall, only the executables matter to the filter
+    {
+        // the app list is refreshed from pool threads
+        QMutexLocker locker(&m_appsMutex);
+        if (userBinaries == m_userBinaries)
+            return;
+        m_userBinaries = userBinaries;
+        m_pidlist["by user apps only"] = userBinaries.join("\\[|") + "\\[";
+        m_pidlist["related to user apps"] = userBinaries.join("|");
+    }
     ReloadLogsFilter();
 }
 
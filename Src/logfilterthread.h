@@ -7,6 +7,7 @@
 #include <QMap>
 #include <QJsonDocument>
 #include "logpacket.h"
+#include "plistview.h"
 
 class LogFilterThread : public QObject
 {
@@ -24,12 +25,13 @@ public:
     void LogsFilterByPID(QString pid_name);
     void SystemLogsFilter(QString text_or_regex, QString pid_name, QString exclude_text);
     void ReloadLogsFilter();
-    void UpdateInstalledList(QMap<QString, QJsonDocument> applist);
+    void UpdateInstalledList(QMap<QString, PlistView> applist);
     void UpdateSystemLog(LogPacket log);
 
 private:
     QList<int> ParsePaddings(LogPacket log);
     QString LogToString(LogPacket log);
+    QString PidFilter(QString pid_name);
     void StartFilter();
     void StopFilter();
 
@@ -42,6 +44,8 @@ private:
     QThread *m_thread;
     QMutex m_mutex;
     std::unordered_map<QString,QString> m_pidlist;
+    QStringList m_userBinaries;
+    QMutex m_appsMutex;
     bool m_processLogs;
 
 signals:
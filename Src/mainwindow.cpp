@@ -5,6 +5,9 @@
 #include "appinfo.h"
 #include "userconfigs.h"
 #include "crashsymbolicator.h"
+#include "dsymindex.h"
+#include "crashclusters.h"
+#include "inliningcache.h"
 #include "asyncmanager.h"
 #include <QFile>
 #include <QMimeData>
@@ -33,7 +36,7 @@ MainWindow::MainWindow(QWidget *parent)
 {
     ui->setupUi(this);
 
-    AsyncManager::Get()->Init(4);
+    AsyncManager::Get()->Init();
     QMainWindow::setWindowTitle(m_appInfo->GetFullname());
     QMainWindow::setWindowIcon(QIcon(":res/bulb.ico"));
     DeviceBridge::Get()->Init(this);
@@ -157,6 +160,9 @@ MainWindow::~MainWindow()
 {
     DeviceBridge::Destroy();
     CrashSymbolicator::Destroy();
+    CrashClusters::Destroy();
+    InliningCache::Destroy();
+    DsymIndex::Destroy();
     Recodesigner::Destroy();
     m_devicesModel->clear();
     delete m_devicesModel;
@@ -97,15 +97,19 @@ private slots:
     //AppManager and Installer UI
 private:
     QString m_choosenBundleId;
-    QMap<QString, QJsonDocument> m_installedApps;
+    QMap<QString, PlistView> m_installedApps;
     void SetupAppManagerUI();
     void RefreshPIDandBundleID();
 private slots:
     void OnInstallClicked();
     void OnUninstallClicked();
     void OnInstallerStatusChanged(InstallerMode command, QString bundleId, int percentage, QString message);
+    void OnInstallJobFinished(QString udid, QString package, bool success, QString message, qint64 uploadMsecs, qint64 installMsecs);
+    void OnInstallBatchProgress(int done, int total, int failed);
+    void OnInstallBatchFinished(int succeeded, int failed, qint64 msecs);
     void OnBundleIdChanged(QString text);
     void OnAppInfoClicked();
+    void OnAppInfoReceived(QString bundleId, QJsonDocument appInfo);
 
     //Recodesigner UI
 private:
@@ -140,6 +144,9 @@ private slots:
     void OnSaveSymbolicatedClicked();
     void OnStacktraceThreadChanged(QString threadName);
     void OnSymbolicateResult2(unsigned int progress, SymbolicatedData data, bool error);
+    void OnSymbolicateBatchProgress(int done, int total, QString message);
+    void OnSymbolicateBatchFinished(QString indexPath, int succeeded, int failed);
+    void OnDsymLocated(QString crashlogPath, QString dsymPath, QString arch);
 
     //Toolbox UI
 private:
@@ -2,6 +2,7 @@
 #include "ui_mainwindow.h"
 #include <QJsonObject>
 #include <QMessageBox>
+#include <QFileInfo>
 
 void MainWindow::SetupAppManagerUI()
 {
@@ -10,17 +11,44 @@ void MainWindow::SetupAppManagerUI()
     connect(ui->installBtn, SIGNAL(pressed()), this, SLOT(OnInstallClicked()));
     connect(ui->UninstallBtn, SIGNAL(pressed()), this, SLOT(OnUninstallClicked()));
     connect(DeviceBridge::Get(), SIGNAL(InstallerStatusChanged(InstallerMode,QString,int,QString)), this, SLOT(OnInstallerStatusChanged(InstallerMode,QString,int,QString)));
+    connect(DeviceBridge::Get(), SIGNAL(InstallJobFinished(QString,QString,bool,QString,qint64,qint64)), this, SLOT(OnInstallJobFinished(QString,QString,bool,QString,qint64,qint64)));
+    connect(DeviceBridge::Get(), SIGNAL(InstallBatchProgress(int,int,int)), this, SLOT(OnInstallBatchProgress(int,int,int)));
+    connect(DeviceBridge::Get(), SIGNAL(InstallBatchFinished(int,int,qint64)), this, SLOT(OnInstallBatchFinished(int,int,qint64)));
     connect(ui->bundleIds, SIGNAL(textActivated(QString)), this, SLOT(OnBundleIdChanged(QString)));
     connect(ui->appInfoBtn, SIGNAL(pressed()), this, SLOT(OnAppInfoClicked()));
+    connect(DeviceBridge::Get(), SIGNAL(AppInfoReceived(QString,QJsonDocument)), this, SLOT(OnAppInfoReceived(QString,QJsonDocument)));
 }
 
 void MainWindow::OnInstallClicked()
 {
-    DeviceBridge::Get()->InstallApp(ui->upgrade->isChecked() ? InstallerMode::CMD_UPGRADE : InstallerMode::CMD_INSTALL, ui->installPath->text());
+    // several packages separated by ';' go to every attached device
+    QStringList packages = ui->installPath->text().split(';', Qt::SkipEmptyParts);
+    InstallerMode cmd = ui->upgrade->isChecked() ? InstallerMode::CMD_UPGRADE : InstallerMode::CMD_INSTALL;
+    if (packages.count() > 1)
+        DeviceBridge::Get()->InstallApps(cmd, DeviceBridge::Get()->GetDevices().keys(), packages);
+    else
+        DeviceBridge::Get()->InstallApp(cmd, ui->installPath->text());
     ui->installBtn->setEnabled(false);
     ui->bottomWidget->setCurrentIndex(1);
 }
 
+void MainWindow::OnInstallJobFinished(QString udid, QString package, bool success, QString message, qint64 uploadMsecs, qint64 installMsecs)
+{
+    ui->outputEdit->appendPlainText(QString("[%1] %2: %3").arg(udid, QFileInfo(package).fileName(), message));
+}
+
+void MainWindow::OnInstallBatchProgress(int done, int total, int failed)
+{
+    ui->installBar->setFormat(QString("%p% (%1/%2, %3 failed)").arg(done).arg(total).arg(failed));
+    ui->installBar->setValue(done * 100 / total);
+}
+
+void MainWindow::OnInstallBatchFinished(int succeeded, int failed, qint64 msecs)
+{
+    ui->outputEdit->appendPlainText(QString("Batch install done in %1 s, %2 succeeded and %3 failed.").arg(msecs / 1000.0, 0, 'f', 1).arg(succeeded).arg(failed));
+    ui->installBtn->setEnabled(true);
+}
+
 void MainWindow::OnUninstallClicked()
 {
     if (!m_choosenBundleId.isEmpty())
@@ -66,7 +94,13 @@ void MainWindow::OnBundleIdChanged(QString text)
 void MainWindow::OnAppInfoClicked()
 {
     if(!m_choosenBundleId.isEmpty())
-        m_textDialog->ShowText("App Information",m_installedApps[m_choosenBundleId].toJson());
+        DeviceBridge::Get()->RequestAppInfo(m_choosenBundleId);
+}
+
+void MainWindow::OnAppInfoReceived(QString bundleId, QJsonDocument appInfo)
+{
+    if (bundleId == m_choosenBundleId)
+        m_textDialog->ShowText("App Information", appInfo.toJson());
 }
 
 void MainWindow::RefreshPIDandBundleID()
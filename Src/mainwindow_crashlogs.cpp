@@ -2,9 +2,11 @@
 #include "ui_mainwindow.h"
 #include "utils.h"
 #include "crashsymbolicator.h"
+#include "dsymindex.h"
 #include <QMessageBox>
 #include <QDesktopServices>
 #include <QFile>
+#include <QFileInfo>
 
 void MainWindow::SetupCrashlogsUI()
 {
@@ -29,6 +31,9 @@ void MainWindow::SetupCrashlogsUI()
         connect(ui->saveSymbolicatedBtn, SIGNAL(pressed()), this, SLOT(OnSaveSymbolicatedClicked()));
         connect(CrashSymbolicator::Get(), SIGNAL(SymbolicateResult2(unsigned int,SymbolicatedData,bool)), this, SLOT(OnSymbolicateResult2(unsigned int,SymbolicatedData,bool)));
         connect(ui->threadEdit, SIGNAL(textActivated(QString)), this, SLOT(OnStacktraceThreadChanged(QString)));
+        connect(CrashSymbolicator::Get(), SIGNAL(BatchProgress(int,int,QString)), this, SLOT(OnSymbolicateBatchProgress(int,int,QString)));
+        connect(CrashSymbolicator::Get(), SIGNAL(BatchFinished(QString,int,int)), this, SLOT(OnSymbolicateBatchFinished(QString,int,int)));
+        connect(DsymIndex::Get(), SIGNAL(DsymLocated(QString,QString,QString)), this, SLOT(OnDsymLocated(QString,QString,QString)));
     }
     m_stacktraceModel->setHorizontalHeaderItem(0, new QStandardItem("Binary"));
     m_stacktraceModel->setHorizontalHeaderItem(1, new QStandardItem("Line"));
@@ -63,24 +68,37 @@ void MainWindow::OnCrashlogClicked()
 {
     QString filepath = ShowBrowseDialog(BROWSE_TYPE::OPEN_FILE, "Crashlog", this);
     ui->crashlogEdit->setText(filepath);
+    if (!filepath.isEmpty())
+        DsymIndex::Get()->Locate(filepath);
 }
 
 void MainWindow::OnDsymClicked()
 {
     QString filepath = ShowBrowseDialog(BROWSE_TYPE::OPEN_DIR, "dSYM", this);
     ui->dsymEdit->setText(filepath);
+    if (!filepath.isEmpty())
+        DsymIndex::Get()->AddSearchPath(filepath);
 }
 
 void MainWindow::OnDwarfClicked()
 {
     QString filepath = ShowBrowseDialog(BROWSE_TYPE::OPEN_FILE, "DWARF", this);
     ui->dsymEdit->setText(filepath);
+    if (!filepath.isEmpty())
+        DsymIndex::Get()->AddSearchPath(filepath);
 }
 
 void MainWindow::OnSymbolicateClicked()
 {
     QString crashpath = ui->crashlogEdit->text();
     QString dsympath = ui->dsymEdit->text();
+    if (QFileInfo(crashpath).isDir())
+    {
+        CrashSymbolicator::Get()->ProcessBatch(crashpath, dsympath.split(';', Qt::SkipEmptyParts));
+        ui->bottomWidget->setCurrentIndex(1);
+        ui->statusbar->showMessage("Symbolicating crashlogs in " + crashpath + "...");
+        return;
+    }
     CrashSymbolicator::Get()->Process(crashpath, dsympath);
 
     m_stacktraceModel->clear();
@@ -154,3 +172,28 @@ void MainWindow::OnSymbolicateResult2(unsigned int progress, SymbolicatedData da
         }
     }
 }
+
+void MainWindow::OnSymbolicateBatchProgress(int done, int total, QString message)
+{
+    QString progress = total > 0 ? QString("(%1/%2) ").arg(done).arg(total) : "";
+    ui->outputEdit->appendPlainText(progress + message);
+}
+
+void MainWindow::OnSymbolicateBatchFinished(QString indexPath, int succeeded, int failed)
+{
+    if (indexPath.isEmpty())
+    {
+        ui->statusbar->showMessage("No crashlogs or dSYMs to symbolicate!");
+        return;
+    }
+    ui->statusbar->showMessage(QString("Batch symbolication done, %1 succeeded and %2 failed.").arg(succeeded).arg(failed));
+    ui->outputEdit->appendPlainText("Summary: " + indexPath);
+}
+
+void MainWindow::OnDsymLocated(QString crashlogPath, QString dsymPath, QString arch)
+{
+    if (crashlogPath != ui->crashlogEdit->text() || dsymPath.isEmpty())
+        return;
+    ui->dsymEdit->setText(dsymPath);
+    ui->statusbar->showMessage("Matching dSYM found (" + arch + ")");
+}
@@ -0,0 +1,153 @@
+#include "perfmetrics.h"
+#include "devicebridge.h"
+#include <QSaveFile>
+#include <QTextStream>
+#include <cmath>
+
+PerfMetrics::PerfMetrics(const QStringList &system_attr, const QStringList &process_attr, int capacity)
+    : m_systemAttrs(system_attr)
+    , m_processAttrs(process_attr)
+    , m_capacity(qMax(1, capacity))
+{
+    m_system.name = "System";
+}
+
+void PerfMetrics::Append(const PerfSample &sample)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!sample.system.empty())
+        Push(m_system, sample.timestamp, sample.system);
+
+    for (const ProcessSample& process : sample.processes)
+    {
+        Series& series = m_processes[process.pid];
+        if (!process.name.isEmpty())
+            series.name = process.name;
+        Push(series, sample.timestamp, process.values);
+    }
+
+    // exited processes leave once their last sample is older than the live window
+    qint64 oldest = sample.timestamp - PERF_WINDOW_MS;
+    for (auto it = m_processes.begin(); it != m_processes.end();)
+    {
+        const Series& series = it.value();
+        qint64 newest = series.size ? series.timestamps[(series.head + series.size - 1) % series.size] : 0;
+        if (newest < oldest)
+            it = m_processes.erase(it);
+        else
+            ++it;
+    }
+}
+
+QMap<qint64, QString> PerfMetrics::GetProcesses()
+{
+    QMutexLocker locker(&m_mutex);
+    QMap<qint64, QString> processes;
+    for (auto it = m_processes.constBegin(); it != m_processes.constEnd(); ++it)
+        processes.insert(it.key(), it.value().name);
+    return processes;
+}
+
+QVector<QPointF> PerfMetrics::GetSystemSeries(int column, qint64 since)
+{
+    QMutexLocker locker(&m_mutex);
+    return Points(m_system, column, since);
+}
+
+QVector<QPointF> PerfMetrics::GetProcessSeries(qint64 pid, int column, qint64 since)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_processes.constFind(pid);
+    if (it == m_processes.constEnd())
+        return QVector<QPointF>();
+    return Points(it.value(), column, since);
+}
+
+bool PerfMetrics::ExportCsv(const QString &path)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        return false;
+
+    QMutexLocker locker(&m_mutex);
+    QTextStream out(&file);
+    // long format, system rows fill the system columns and process rows the process ones
+    out << "timestamp,pid,name";
+    foreach (const QString& attr, m_systemAttrs)
+        out << ",system." << attr;
+    foreach (const QString& attr, m_processAttrs)
+        out << "," << attr;
+    out << "\n";
+
+    auto write_series = [&](const Series& series, const QString& pid, int offset) {
+        QString name = series.name;
+        name.replace('"', "\"\"");
+        for (int i = 0; i < series.size; i++)
+        {
+            int idx = series.size < m_capacity ? i : (series.head + i) % m_capacity;
+            out << series.timestamps[idx] << "," << pid << ",\"" << name << "\"";
+            for (int col = 0; col < offset; col++)
+                out << ",";
+            for (const auto& column : series.columns)
+            {
+                out << ",";
+                if (!std::isnan(column[idx]))
+                    out << column[idx];
+            }
+            for (int col = offset + (int)series.columns.size(); col < m_systemAttrs.size() + m_processAttrs.size(); col++)
+                out << ",";
+            out << "\n";
+        }
+    };
+
+    write_series(m_system, "", 0);
+    for (auto it = m_processes.constBegin(); it != m_processes.constEnd(); ++it)
+        write_series(it.value(), QString::number(it.key()), m_systemAttrs.size());
+
+    out.flush();
+    return file.commit();
+}
+
+void PerfMetrics::Push(Series &series, qint64 timestamp, const std::vector<double> &values)
+{
+    if (series.columns.size() != values.size())
+    {
+        // first sample of the series
+        series.columns.assign(values.size(), std::vector<float>());
+        series.timestamps.clear();
+        series.head = 0;
+        series.size = 0;
+    }
+
+    if (series.size < m_capacity)
+    {
+        series.timestamps.push_back(timestamp);
+        for (size_t col = 0; col < values.size(); col++)
+            series.columns[col].push_back((float)values[col]);
+        series.size++;
+        return;
+    }
+
+    series.timestamps[series.head] = timestamp;
+    for (size_t col = 0; col < values.size(); col++)
+        series.columns[col][series.head] = (float)values[col];
+    series.head = (series.head + 1) % m_capacity;
+}
+
+QVector<QPointF> PerfMetrics::Points(const Series &series, int column, qint64 since)
+{
+    QVector<QPointF> points;
+    if (column < 0 || column >= (int)series.columns.size())
+        return points;
+
+    const std::vector<float>& values = series.columns[column];
+    points.reserve(series.size);
+    for (int i = 0; i < series.size; i++)
+    {
+        int idx = series.size < m_capacity ? i : (series.head + i) % m_capacity;
+        if (series.timestamps[idx] < since || std::isnan(values[idx]))
+            continue;
+        points.append(QPointF(series.timestamps[idx], values[idx]));
+    }
+    return points;
+}
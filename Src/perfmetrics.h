@@ -0,0 +1,64 @@
+#ifndef PERFMETRICS_H
+#define PERFMETRICS_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QPointF>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <vector>
+
+// values follow the attribute order the sysmontap channel was configured with, NaN when missing
+struct ProcessSample
+{
+    qint64 pid;
+    QString name;
+    std::vector<double> values;
+};
+
+struct PerfSample
+{
+    qint64 timestamp;
+    std::vector<double> system;
+    std::vector<ProcessSample> processes;
+};
+
+// live window of sysmontap samples, one column per attribute, oldest samples are overwritten
+class PerfMetrics
+{
+public:
+    PerfMetrics(const QStringList& system_attr, const QStringList& process_attr, int capacity);
+
+    void Append(const PerfSample& sample);
+    QStringList GetSystemAttributes() { return m_systemAttrs; }
+    QStringList GetProcessAttributes() { return m_processAttrs; }
+    QMap<qint64, QString> GetProcesses();
+    // (timestamp, value) points oldest first, ready for a chart series
+    QVector<QPointF> GetSystemSeries(int column, qint64 since = 0);
+    QVector<QPointF> GetProcessSeries(qint64 pid, int column, qint64 since = 0);
+    bool ExportCsv(const QString& path);
+
+private:
+    struct Series
+    {
+        QString name;
+        std::vector<qint64> timestamps;
+        std::vector<std::vector<float>> columns;
+        int head = 0;
+        int size = 0;
+    };
+
+    void Push(Series& series, qint64 timestamp, const std::vector<double>& values);
+    QVector<QPointF> Points(const Series& series, int column, qint64 since);
+
+    QStringList m_systemAttrs;
+    QStringList m_processAttrs;
+    int m_capacity;
+    Series m_system;
+    QHash<qint64, Series> m_processes;
+    QMutex m_mutex;
+};
+
+#endif // PERFMETRICS_H
@@ -0,0 +1,522 @@
+#include "perfstore.h"
+#include "userconfigs.h"
+#include "utils.h"
+#include <QDir>
+#include <QDateTime>
+#include <QCoreApplication>
+#include <QtEndian>
+#include <cmath>
+#include <cstring>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <signal.h>
+#include <errno.h>
+#endif
+
+const int kPERF_MEMORY_BUDGET_MB = 64;
+const int kPERF_SPILL_RETRY_CHUNKS = 64;
+
+// msb first bit stream
+class BitWriter
+{
+public:
+    void Write(quint64 value, int bits)
+    {
+        for (int i = bits - 1; i >= 0; i--)
+        {
+            if (m_bit == 0)
+                m_data.append('\0');
+            if ((value >> i) & 1)
+                m_data.data()[m_data.size() - 1] |= (char)(0x80 >> m_bit);
+            m_bit = (m_bit + 1) % 8;
+        }
+    }
+    const QByteArray& Data() { return m_data; }
+
+private:
+    QByteArray m_data;
+    int m_bit = 0;
+};
+
+class BitReader
+{
+public:
+    BitReader(const char* data, qint64 size) : m_data((const uchar*)data), m_size(size * 8) {}
+    quint64 Read(int bits)
+    {
+        quint64 value = 0;
+        for (int i = 0; i < bits; i++)
+        {
+            value <<= 1;
+            if (m_pos < m_size)
+                value |= (m_data[m_pos / 8] >> (7 - m_pos % 8)) & 1;
+            m_pos++;
+        }
+        return value;
+    }
+
+private:
+    const uchar* m_data;
+    qint64 m_size;
+    qint64 m_pos = 0;
+};
+
+static quint64 DoubleBits(double value)
+{
+    quint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double BitsDouble(quint64 bits)
+{
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// delta-of-delta, most samples arrive on the configured interval and cost a single bit
+static QByteArray EncodeTimestamps(const std::vector<qint64>& timestamps)
+{
+    BitWriter writer;
+    qint64 prev = 0, prev_delta = 0;
+    for (size_t i = 0; i < timestamps.size(); i++)
+    {
+        if (i == 0)
+        {
+            writer.Write((quint64)timestamps[i], 64);
+            prev = timestamps[i];
+            continue;
+        }
+        qint64 delta = timestamps[i] - prev;
+        qint64 dod = delta - prev_delta;
+        if (dod == 0)
+            writer.Write(0, 1);
+        else if (dod >= -63 && dod <= 64)
+        {
+            writer.Write(0x2, 2);
+            writer.Write((quint64)(dod + 63), 7);
+        }
+        else if (dod >= -255 && dod <= 256)
+        {
+            writer.Write(0x6, 3);
+            writer.Write((quint64)(dod + 255), 9);
+        }
+        else if (dod >= -2047 && dod <= 2048)
+        {
+            writer.Write(0xe, 4);
+            writer.Write((quint64)(dod + 2047), 12);
+        }
+        else
+        {
+            writer.Write(0xf, 4);
+            writer.Write((quint64)dod, 64);
+        }
+        prev = timestamps[i];
+        prev_delta = delta;
+    }
+    return writer.Data();
+}
+
+static void DecodeTimestamps(const char* data, qint64 size, int count, std::vector<qint64>& timestamps)
+{
+    BitReader reader(data, size);
+    qint64 prev = 0, prev_delta = 0;
+    timestamps.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        if (i == 0)
+        {
+            prev = (qint64)reader.Read(64);
+            timestamps[i] = prev;
+            continue;
+        }
+        qint64 dod = 0;
+        if (reader.Read(1))
+        {
+            if (!reader.Read(1))
+                dod = (qint64)reader.Read(7) - 63;
+            else if (!reader.Read(1))
+                dod = (qint64)reader.Read(9) - 255;
+            else if (!reader.Read(1))
+                dod = (qint64)reader.Read(12) - 2047;
+            else
+                dod = (qint64)reader.Read(64);
+        }
+        prev_delta += dod;
+        prev += prev_delta;
+        timestamps[i] = prev;
+    }
+}
+
+// XOR with the previous value, unchanged values cost a bit and slow moving ones reuse the previous bit window
+static QByteArray EncodeValues(const std::vector<double>& values)
+{
+    BitWriter writer;
+    quint64 prev = 0;
+    int prev_lead = -1, prev_trail = 0;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        quint64 bits = DoubleBits(values[i]);
+        if (i == 0)
+        {
+            writer.Write(bits, 64);
+            prev = bits;
+            continue;
+        }
+        quint64 x = bits ^ prev;
+        prev = bits;
+        if (x == 0)
+        {
+            writer.Write(0, 1);
+            continue;
+        }
+        writer.Write(1, 1);
+        int lead = qMin(31, (int)qCountLeadingZeroBits(x));
+        int trail = (int)qCountTrailingZeroBits(x);
+        if (prev_lead >= 0 && lead >= prev_lead && trail >= prev_trail)
+        {
+            writer.Write(0, 1);
+            writer.Write(x >> prev_trail, 64 - prev_lead - prev_trail);
+        }
+        else
+        {
+            int meaningful = 64 - lead - trail;
+            writer.Write(1, 1);
+            writer.Write((quint64)lead, 5);
+            writer.Write((quint64)(meaningful & 0x3f), 6);
+            writer.Write(x >> trail, meaningful);
+            prev_lead = lead;
+            prev_trail = trail;
+        }
+    }
+    return writer.Data();
+}
+
+static void DecodeValues(const char* data, qint64 size, int count, std::vector<double>& values)
+{
+    BitReader reader(data, size);
+    quint64 prev = 0;
+    int prev_lead = 0, prev_trail = 0;
+    values.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        if (i == 0)
+        {
+            prev = reader.Read(64);
+            values[i] = BitsDouble(prev);
+            continue;
+        }
+        if (reader.Read(1))
+        {
+            if (reader.Read(1))
+            {
+                prev_lead = (int)reader.Read(5);
+                int meaningful = (int)reader.Read(6);
+                if (meaningful == 0)
+                    meaningful = 64;
+                prev_trail = 64 - prev_lead - meaningful;
+            }
+            prev ^= reader.Read(64 - prev_lead - prev_trail) << prev_trail;
+        }
+        values[i] = BitsDouble(prev);
+    }
+}
+
+static bool IsProcessRunning(qint64 pid)
+{
+#ifdef WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+    if (!process)
+        return GetLastError() == ERROR_ACCESS_DENIED;
+    bool running = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return running;
+#else
+    return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+PerfStore::PerfStore(const QString &udid)
+    : m_udid(udid)
+    , m_residentBytes(0)
+    , m_memoryBudget((qint64)UserConfigs::Get()->GetData("PerfStoreMemoryMB", kPERF_MEMORY_BUDGET_MB) * 1024 * 1024)
+    , m_spillRetry(0)
+{
+}
+
+PerfStore::~PerfStore()
+{
+    if (m_spill.isOpen())
+        m_spill.remove();
+}
+
+void PerfStore::Append(const QString &series, const QStringList &columns, qint64 timestamp, const std::vector<double> &values)
+{
+    QMutexLocker locker(&m_mutex);
+    Push(series, columns, timestamp, values);
+    Spill();
+}
+
+void PerfStore::Append(const PerfSample &sample, const QStringList &system_attr, const QStringList &process_attr)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!sample.system.empty())
+        Push("System", system_attr, sample.timestamp, sample.system);
+    for (const ProcessSample& process : sample.processes)
+        Push(QString::number(process.pid) + "/" + process.name, process_attr, sample.timestamp, process.values);
+    Spill();
+}
+
+QStringList PerfStore::GetSeries()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_series.keys();
+}
+
+QStringList PerfStore::GetColumns(const QString &series)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_series.constFind(series);
+    return it != m_series.constEnd() ? it.value().columns : QStringList();
+}
+
+QVector<QPointF> PerfStore::Query(const QString &series, int column, qint64 from, qint64 to, int max_points)
+{
+    QMutexLocker locker(&m_mutex);
+    QVector<QPointF> points;
+    auto it = m_series.constFind(series);
+    if (it == m_series.constEnd() || column < 0 || column >= it.value().columns.size())
+        return points;
+    const Series& data = it.value();
+
+    bool raw = max_points <= 0 || to <= from;
+    double width = raw ? 1.0 : double(to - from) / max_points;
+    std::vector<double> sums(raw ? 0 : max_points, 0.0);
+    std::vector<int> counts(raw ? 0 : max_points, 0);
+    auto bucket_of = [&](qint64 timestamp) {
+        return qMin(max_points - 1, int((timestamp - from) / width));
+    };
+    auto add = [&](qint64 timestamp, double value) {
+        if (timestamp < from || timestamp > to || std::isnan(value))
+            return;
+        if (raw)
+        {
+            points.append(QPointF(timestamp, value));
+            return;
+        }
+        int bucket = bucket_of(timestamp);
+        sums[bucket] += value;
+        counts[bucket]++;
+    };
+
+    std::vector<qint64> timestamps;
+    std::vector<double> values;
+    for (const Chunk& chunk : data.chunks)
+    {
+        if (chunk.last < from || chunk.first > to)
+            continue;
+        if (!raw && chunk.first >= from && chunk.last <= to && bucket_of(chunk.first) == bucket_of(chunk.last))
+        {
+            sums[bucket_of(chunk.first)] += chunk.sum[column];
+            counts[bucket_of(chunk.first)] += chunk.valid[column];
+            continue;
+        }
+        Decode(Load(chunk), column, timestamps, values);
+        for (size_t i = 0; i < timestamps.size() && i < values.size(); i++)
+            add(timestamps[i], values[i]);
+    }
+    for (size_t i = 0; i < data.timestamps.size(); i++)
+        add(data.timestamps[i], data.values[column][i]);
+
+    for (int bucket = 0; bucket < (int)counts.size(); bucket++)
+    {
+        if (counts[bucket])
+            points.append(QPointF(from + (bucket + 0.5) * width, sums[bucket] / counts[bucket]));
+    }
+    return points;
+}
+
+qint64 PerfStore::GetMemoryUsage()
+{
+    QMutexLocker locker(&m_mutex);
+    qint64 bytes = m_residentBytes;
+    foreach (const Series& series, m_series)
+        bytes += (qint64)series.timestamps.capacity() * sizeof(qint64) + (qint64)series.columns.size() * PERF_CHUNK_SAMPLES * sizeof(double);
+    return bytes;
+}
+
+qint64 PerfStore::GetDiskUsage()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_spill.isOpen() ? m_spill.size() : 0;
+}
+
+void PerfStore::Push(const QString &key, const QStringList &columns, qint64 timestamp, const std::vector<double> &values)
+{
+    Series& series = m_series[key];
+    if (series.columns.isEmpty())
+    {
+        series.columns = columns;
+        series.values.assign(columns.size(), std::vector<double>());
+        series.timestamps.reserve(PERF_CHUNK_SAMPLES);
+        for (auto& column : series.values)
+            column.reserve(PERF_CHUNK_SAMPLES);
+    }
+
+    series.timestamps.push_back(timestamp);
+    for (size_t col = 0; col < series.values.size(); col++)
+        series.values[col].push_back(col < values.size() ? values[col] : std::nan(""));
+
+    if (series.timestamps.size() >= PERF_CHUNK_SAMPLES)
+        Seal(key, series);
+}
+
+void PerfStore::Seal(const QString &key, Series &series)
+{
+    Chunk chunk;
+    chunk.first = series.timestamps.front();
+    chunk.last = series.timestamps.back();
+    chunk.count = (int)series.timestamps.size();
+    chunk.sum.assign(series.values.size(), 0.0);
+    chunk.valid.assign(series.values.size(), 0);
+    for (size_t col = 0; col < series.values.size(); col++)
+    {
+        for (double value : series.values[col])
+        {
+            if (std::isnan(value))
+                continue;
+            chunk.sum[col] += value;
+            chunk.valid[col]++;
+        }
+    }
+    chunk.data = Encode(series);
+    m_residentBytes += chunk.data.size();
+    series.chunks.push_back(chunk);
+    m_resident.push_back(qMakePair(key, (int)series.chunks.size() - 1));
+    if (m_spillRetry > 0)
+        m_spillRetry--;
+
+    series.timestamps.clear();
+    for (auto& column : series.values)
+        column.clear();
+}
+
+void PerfStore::RemoveStaleSpills()
+{
+    // a crashed run never got to remove its spill file, names are perf_<pid>_<udid>_<msecs>.bin
+    QDir dir(GetDirectory(DIRECTORY_TYPE::TEMP));
+    foreach (const QString& name, dir.entryList(QStringList() << "perf_*.bin", QDir::Files))
+    {
+        QStringList parts = name.split('_');
+        bool ok = false;
+        qint64 pid = parts.size() == 4 ? parts[1].toLongLong(&ok) : 0;
+        if (ok && (pid == QCoreApplication::applicationPid() || IsProcessRunning(pid)))
+            continue;
+        dir.remove(name);
+    }
+}
+
+void PerfStore::Spill()
+{
+    // after a failed write the chunks stay resident until a few more were sealed, then spilling is tried again
+    if (m_spillRetry > 0)
+        return;
+
+    while (m_residentBytes > m_memoryBudget && !m_resident.empty())
+    {
+        auto resident = m_resident.front();
+        m_resident.pop_front();
+        Chunk& chunk = m_series[resident.first].chunks[resident.second];
+
+        if (!m_spill.isOpen())
+        {
+            QString dir = GetDirectory(DIRECTORY_TYPE::TEMP);
+            QDir().mkpath(dir);
+            QString udid = m_udid;
+            m_spill.setFileName(dir + "perf_" + QString::number(QCoreApplication::applicationPid()) + "_" + udid.remove(':') + "_" + QString::number(QDateTime::currentMSecsSinceEpoch()) + ".bin");
+            if (!m_spill.open(QIODevice::ReadWrite | QIODevice::Truncate))
+            {
+                // keep everything in memory rather than lose samples
+                m_resident.push_front(resident);
+                m_spillRetry = kPERF_SPILL_RETRY_CHUNKS;
+                return;
+            }
+        }
+
+        m_spill.seek(m_spill.size());
+        qint64 offset = m_spill.pos();
+        if (m_spill.write(chunk.data) != chunk.data.size() || !m_spill.flush())
+        {
+            // disk full or gone, drop the partial write and keep the chunk instead of losing it
+            m_spill.resize(offset);
+            m_resident.push_front(resident);
+            m_spillRetry = kPERF_SPILL_RETRY_CHUNKS;
+            return;
+        }
+        chunk.offset = offset;
+        chunk.length = (int)chunk.data.size();
+        m_residentBytes -= chunk.data.size();
+        chunk.data = QByteArray();
+    }
+}
+
+QByteArray PerfStore::Load(const Chunk &chunk)
+{
+    if (chunk.offset < 0)
+        return chunk.data;
+    m_spill.seek(chunk.offset);
+    return m_spill.read(chunk.length);
+}
+
+QByteArray PerfStore::Encode(const Series &series)
+{
+    // count, stream count, stream sizes, timestamps stream, one stream per column
+    QList<QByteArray> streams;
+    streams << EncodeTimestamps(series.timestamps);
+    for (const auto& column : series.values)
+        streams << EncodeValues(column);
+
+    QByteArray data;
+    auto write_u32 = [&data](quint32 value) {
+        value = qToLittleEndian(value);
+        data.append((const char*)&value, sizeof(value));
+    };
+    write_u32((quint32)series.timestamps.size());
+    write_u32((quint32)streams.size());
+    foreach (const QByteArray& stream, streams)
+        write_u32((quint32)stream.size());
+    foreach (const QByteArray& stream, streams)
+        data.append(stream);
+    return data;
+}
+
+void PerfStore::Decode(const QByteArray &data, int column, std::vector<qint64> &timestamps, std::vector<double> &values)
+{
+    timestamps.clear();
+    values.clear();
+    auto read_u32 = [&data](qint64 offset) {
+        quint32 value = 0;
+        if (offset + (qint64)sizeof(value) <= data.size())
+            memcpy(&value, data.constData() + offset, sizeof(value));
+        return qFromLittleEndian(value);
+    };
+
+    int count = (int)read_u32(0);
+    int streams = (int)read_u32(4);
+    if (column + 1 >= streams)
+        return;
+    qint64 offset = 8 + (qint64)streams * 4;
+    qint64 timestamps_size = read_u32(8);
+    qint64 column_offset = offset;
+    for (int i = 0; i <= column; i++)
+        column_offset += read_u32(8 + i * 4);
+    qint64 column_size = read_u32(8 + (column + 1) * 4);
+    if (column_offset + column_size > data.size())
+        return;
+
+    DecodeTimestamps(data.constData() + offset, timestamps_size, count, timestamps);
+    DecodeValues(data.constData() + column_offset, column_size, count, values);
+}
@@ -0,0 +1,79 @@
+#ifndef PERFSTORE_H
+#define PERFSTORE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QPointF>
+#include <QHash>
+#include <QFile>
+#include <QMutex>
+#include <deque>
+#include <vector>
+#include "perfmetrics.h"
+
+#define PERF_CHUNK_SAMPLES              256
+
+// long running performance samples of one device
+// every series is split in chunks of PERF_CHUNK_SAMPLES, sealed chunks are compressed
+// (delta-of-delta timestamps, XOR values) and spilled to disk once over the memory budget
+class PerfStore
+{
+public:
+    PerfStore(const QString& udid);
+    ~PerfStore();
+
+    void Append(const QString& series, const QStringList& columns, qint64 timestamp, const std::vector<double>& values);
+    // "System" and one "pid/name" series per process
+    void Append(const PerfSample& sample, const QStringList& system_attr, const QStringList& process_attr);
+    QStringList GetSeries();
+    QStringList GetColumns(const QString& series);
+    // bucket averages over [from, to], raw points when max_points is 0
+    QVector<QPointF> Query(const QString& series, int column, qint64 from, qint64 to, int max_points = 0);
+    qint64 GetMemoryUsage();
+    qint64 GetDiskUsage();
+    // spill files whose owning process is gone, files of other running instances are kept
+    static void RemoveStaleSpills();
+
+private:
+    struct Chunk
+    {
+        qint64 first = 0;
+        qint64 last = 0;
+        int count = 0;
+        // summaries let a query skip decoding chunks that fall in a single bucket
+        std::vector<double> sum;
+        std::vector<int> valid;
+        QByteArray data;
+        qint64 offset = -1;
+        int length = 0;
+    };
+
+    struct Series
+    {
+        QStringList columns;
+        std::vector<qint64> timestamps;
+        std::vector<std::vector<double>> values;
+        std::vector<Chunk> chunks;
+    };
+
+    void Push(const QString& key, const QStringList& columns, qint64 timestamp, const std::vector<double>& values);
+    void Seal(const QString& key, Series& series);
+    void Spill();
+    QByteArray Load(const Chunk& chunk);
+    static QByteArray Encode(const Series& series);
+    static void Decode(const QByteArray& data, int column, std::vector<qint64>& timestamps, std::vector<double>& values);
+
+    QString m_udid;
+    QHash<QString, Series> m_series;
+    // sealed chunks still in memory, oldest first
+    std::deque<QPair<QString, int>> m_resident;
+    qint64 m_residentBytes;
+    qint64 m_memoryBudget;
+    // sealed chunks to wait for before spilling again after a failed write
+    int m_spillRetry;
+    QFile m_spill;
+    QMutex m_mutex;
+};
+
+#endif // PERFSTORE_H
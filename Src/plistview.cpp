@@ -0,0 +1,120 @@
+#include "plistview.h"
+#include "extended_plist.h"
+
+PlistView::Data::~Data()
+{
+    if (root)
+        plist_free(root);
+}
+
+PlistView::PlistView()
+{
+}
+
+PlistView::PlistView(plist_t node)
+    : m_data(std::make_shared<Data>())
+{
+    m_data->root = node;
+}
+
+PlistView PlistView::FromBinary(const QByteArray &data)
+{
+    plist_t node = nullptr;
+    plist_from_bin(data.constData(), (uint32_t)data.size(), &node);
+    return PlistView(node);
+}
+
+bool PlistView::IsValid() const
+{
+    return m_data && m_data->root;
+}
+
+bool PlistView::Contains(const QString &key) const
+{
+    return Resolve(key) != nullptr;
+}
+
+QStringList PlistView::Keys() const
+{
+    QStringList keys;
+    if (!IsValid() || plist_get_node_type(m_data->root) != PLIST_DICT)
+        return keys;
+
+    plist_dict_iter it = nullptr;
+    char* key = nullptr;
+    plist_t subnode = nullptr;
+    plist_dict_new_iter(m_data->root, &it);
+    plist_dict_next_item(m_data->root, it, &key, &subnode);
+    while (subnode)
+    {
+        keys << QString::fromUtf8(key);
+        free(key);
+        key = nullptr;
+        plist_dict_next_item(m_data->root, it, &key, &subnode);
+    }
+    free(key);
+    free(it);
+    return keys;
+}
+
+QJsonValue PlistView::Value(const QString &path) const
+{
+    if (!IsValid())
+        return QJsonValue(QJsonValue::Undefined);
+
+    QMutexLocker locker(&m_data->mutex);
+    auto it = m_data->values.constFind(path);
+    if (it != m_data->values.constEnd())
+        return it.value();
+
+    // only the requested subtree is converted
+    plist_t node = Resolve(path);
+    QJsonValue value = node ? PlistNodeToJsonValue(node) : QJsonValue(QJsonValue::Undefined);
+    m_data->values.insert(path, value);
+    return value;
+}
+
+QByteArray PlistView::toJson() const
+{
+    if (!IsValid())
+        return QByteArray();
+    return PlistToJson(m_data->root).toJson();
+}
+
+plist_t PlistView::Copy() const
+{
+    return IsValid() ? plist_copy(m_data->root) : nullptr;
+}
+
+plist_t PlistView::Resolve(const QString &path) const
+{
+    if (!IsValid())
+        return nullptr;
+
+    // '/' separated dictionary keys and array indexes
+    plist_t node = m_data->root;
+    foreach (const QString& part, path.split('/', Qt::SkipEmptyParts))
+    {
+        switch (plist_get_node_type(node))
+        {
+        case PLIST_DICT:
+            node = plist_dict_get_item(node, part.toUtf8().constData());
+            break;
+
+        case PLIST_ARRAY:
+            {
+                bool ok = false;
+                uint32_t idx = part.toUInt(&ok);
+                node = ok && idx < plist_array_get_size(node) ? plist_array_get_item(node, idx) : nullptr;
+            }
+            break;
+
+        default:
+            node = nullptr;
+            break;
+        }
+        if (!node)
+            return nullptr;
+    }
+    return node;
+}
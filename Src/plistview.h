@@ -0,0 +1,44 @@
+#ifndef PLISTVIEW_H
+#define PLISTVIEW_H
+
+#include <plist/plist.h>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QJsonValue>
+#include <QHash>
+#include <QMutex>
+#include <memory>
+
+// read-only view over a plist tree, values are converted to json only when asked for
+class PlistView
+{
+public:
+    PlistView();
+    // takes ownership of the node
+    explicit PlistView(plist_t node);
+    static PlistView FromBinary(const QByteArray& data);
+
+    bool IsValid() const;
+    bool Contains(const QString& key) const;
+    QStringList Keys() const;
+    QJsonValue Value(const QString& path) const;
+    QJsonValue operator[](const QString& key) const { return Value(key); }
+    QByteArray toJson() const;
+    // deep copy of the whole tree, owned by the caller
+    plist_t Copy() const;
+
+private:
+    struct Data
+    {
+        ~Data();
+        plist_t root = nullptr;
+        QHash<QString, QJsonValue> values;
+        QMutex mutex;
+    };
+    plist_t Resolve(const QString& path) const;
+
+    std::shared_ptr<Data> m_data;
+};
+
+#endif // PLISTVIEW_H
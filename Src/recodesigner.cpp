@@ -154,5 +154,5 @@ void Recodesigner::Process(const Recodesigner::Params& params)
             emit SigningResult(SigningStatus::INSTALL, 100.f, QString("Done and continue to install!%1").arg(end_message));
         else
             emit SigningResult(SigningStatus::SUCCESS, 100.f, QString("Done!%1").arg(end_message));
-    });
+    }, TASK_BULK);
 }
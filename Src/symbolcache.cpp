@@ -0,0 +1,79 @@
+#include "symbolcache.h"
+
+SymbolCache::SymbolCache(qsizetype maxImages, qsizetype maxSymbols)
+    : m_symbolCount(0)
+    , m_maxImages(maxImages)
+    , m_maxSymbols(maxSymbols)
+{
+}
+
+QString SymbolCache::Resolve(const QString &uuid, quint64 address, const std::function<QString (quint64)> &resolver)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        auto image = m_images.find(uuid);
+        if (image != m_images.end())
+        {
+            auto it = image->symbols.constFind(address);
+            if (it != image->symbols.constEnd())
+            {
+                m_recent.splice(m_recent.begin(), m_recent, image->recent);
+                return it.value();
+            }
+        }
+    }
+
+    QString symbol = resolver ? resolver(address) : QString();
+
+    QMutexLocker locker(&m_mutex);
+    Image& image = Touch(uuid);
+    if (!image.symbols.contains(address))
+    {
+        image.symbols.insert(address, symbol);
+        m_symbolCount++;
+    }
+    Evict(uuid);
+    return symbol;
+}
+
+qsizetype SymbolCache::ImageCount()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_images.count();
+}
+
+void SymbolCache::Clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_images.clear();
+    m_recent.clear();
+    m_symbolCount = 0;
+}
+
+SymbolCache::Image &SymbolCache::Touch(const QString &uuid)
+{
+    auto it = m_images.find(uuid);
+    if (it != m_images.end())
+    {
+        m_recent.splice(m_recent.begin(), m_recent, it->recent);
+        return it.value();
+    }
+
+    m_recent.push_front(uuid);
+    Image& image = m_images[uuid];
+    image.recent = m_recent.begin();
+    return image;
+}
+
+void SymbolCache::Evict(const QString &keep)
+{
+    while (m_recent.size() > 1 && ((qsizetype)m_recent.size() > m_maxImages || m_symbolCount > m_maxSymbols))
+    {
+        QString uuid = m_recent.back();
+        if (uuid == keep)
+            break;
+        m_recent.pop_back();
+        m_symbolCount -= m_images.value(uuid).symbols.count();
+        m_images.remove(uuid);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef SYMBOLCACHE_H
+#define SYMBOLCACHE_H
+
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <functional>
+#include <list>
+
+class SymbolCache
+{
+public:
+    SymbolCache(qsizetype maxImages = 64, qsizetype maxSymbols = 1024 * 1024);
+
+    QString Resolve(const QString& uuid, quint64 address, const std::function<QString(quint64)>& resolver);
+    qsizetype ImageCount();
+    void Clear();
+
+private:
+    typedef std::list<QString> RecentList;
+    struct Image
+    {
+        QHash<quint64, QString> symbols;
+        RecentList::iterator recent;
+    };
+
+    Image& Touch(const QString& uuid);
+    void Evict(const QString& keep);
+
+    // whole images leave least recently used first, bounded by image and symbol count
+    QHash<QString, Image> m_images;
+    RecentList m_recent;
+    qsizetype m_symbolCount;
+    qsizetype m_maxImages;
+    qsizetype m_maxSymbols;
+    QMutex m_mutex;
+};
+
+#endif // SYMBOLCACHE_H